@@ -84,7 +84,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -216,7 +216,7 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
 
 	c = d->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
+	select_sector (d, sec_no, 1);
 	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
 	sema_down (&c->completion_wait);
 	if (!wait_while_busy (d))
@@ -240,7 +240,7 @@ disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
 
 	c = d->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
+	select_sector (d, sec_no, 1);
 	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
 	if (!wait_while_busy (d))
 		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
@@ -250,6 +250,70 @@ disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
 	lock_release (&c->lock);
 }
 
+/* Reads the CNT sectors starting at SEC_NO from disk D, sector I
+   into BUFFERS[I], with a single READ SECTOR command.  Each buffer
+   must have room for DISK_SECTOR_SIZE bytes and CNT must be
+   between 1 and DISK_BURST_MAX.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_readv (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffers[]) {
+	struct channel *c;
+	size_t i;
+
+	ASSERT (d != NULL);
+	ASSERT (cnt > 0 && cnt <= DISK_BURST_MAX);
+
+	c = d->channel;
+	lock_acquire (&c->lock);
+	select_sector (d, sec_no, cnt);
+	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+	for (i = 0; i < cnt; i++) {
+		/* The disk interrupts once per sector it has ready. */
+		sema_down (&c->completion_wait);
+		if (!wait_while_busy (d))
+			PANIC ("%s: disk read failed, sector=%"PRDSNu,
+					d->name, sec_no + (disk_sector_t) i);
+		input_sector (c, buffers[i]);
+	}
+	d->read_cnt += cnt;
+	lock_release (&c->lock);
+}
+
+/* Writes BUFFERS[I] to sector SEC_NO + I of disk D, for I from 0
+   to CNT - 1, with a single WRITE SECTOR command.  Returns after
+   the disk has acknowledged receiving all the data.  CNT must be
+   between 1 and DISK_BURST_MAX.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_writev (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffers[]) {
+	struct channel *c;
+	size_t i;
+
+	ASSERT (d != NULL);
+	ASSERT (cnt > 0 && cnt <= DISK_BURST_MAX);
+
+	c = d->channel;
+	lock_acquire (&c->lock);
+	select_sector (d, sec_no, cnt);
+	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+	for (i = 0; i < cnt; i++) {
+		/* The disk interrupts once it is ready for the next sector. */
+		if (i > 0)
+			sema_down (&c->completion_wait);
+		if (!wait_while_busy (d))
+			PANIC ("%s: disk write failed, sector=%"PRDSNu,
+					d->name, sec_no + (disk_sector_t) i);
+		output_sector (c, buffers[i]);
+	}
+	sema_down (&c->completion_wait);
+	d->write_cnt += cnt;
+	lock_release (&c->lock);
+}
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -402,17 +466,18 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count of CNT sectors to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (sec_no + cnt <= d->capacity);
+	ASSERT (sec_no + cnt <= (1UL << 28));
+	ASSERT (cnt > 0 && cnt <= DISK_BURST_MAX);
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	outb (reg_nsect (c), cnt);   /* 256 wraps to 0, which means 256. */
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
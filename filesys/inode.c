@@ -6,6 +6,13 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/exec_cache.h"
+#endif
+#ifdef VM
+#include "vm/filemap.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -33,6 +40,9 @@ struct inode {
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+#ifdef USERPROG
+	bool exec_cached;                   /* May be in the exec cache. */
+#endif
 	struct inode_disk data;             /* Inode content. */
 };
 
@@ -125,6 +135,9 @@ inode_open (disk_sector_t sector) {
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
+#ifdef USERPROG
+	inode->exec_cached = exec_cache_contains (inode);
+#endif
 	disk_read (filesys_disk, inode->sector, &inode->data);
 	return inode;
 }
@@ -137,6 +150,15 @@ inode_reopen (struct inode *inode) {
 	return inode;
 }
 
+#ifdef USERPROG
+/* Notes that INODE is being run, so that writes to it invalidate the
+ * exec cache.  Writes to other files leave the cache alone. */
+void
+inode_mark_exec_cached (struct inode *inode) {
+	inode->exec_cached = true;
+}
+#endif
+
 /* Returns INODE's inode number. */
 disk_sector_t
 inode_get_inumber (const struct inode *inode) {
@@ -159,6 +181,13 @@ inode_close (struct inode *inode) {
 
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
+#ifdef USERPROG
+			exec_cache_invalidate (inode);
+#endif
+#ifdef VM
+			/* Its sectors may soon belong to another file. */
+			filemap_forget_inode (inode);
+#endif
 			free_map_release (inode->sector, 1);
 			free_map_release (inode->data.start,
 					bytes_to_sectors (inode->data.length)); 
@@ -283,7 +312,82 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		bytes_written += chunk_size;
 	}
 	free (bounce);
+#ifdef USERPROG
+	/* A program's layout may have changed. */
+	if (bytes_written > 0 && inode->exec_cached)
+		exec_cache_invalidate (inode);
+#endif
+#ifdef VM
+	/* Keep the mapped pages of the file up to date. */
+	filemap_write (inode, offset - bytes_written, buffer, bytes_written);
+#endif
+
+	return bytes_written;
+}
+
+/* Writes SIZE bytes into INODE, starting at OFFSET, which must be a
+ * multiple of DISK_SECTOR_SIZE, from the page-sized buffers PAGES,
+ * byte I from PAGES[I / PGSIZE].  The file's sectors are contiguous,
+ * so whole sectors go to disk DISK_BURST_MAX at a time with
+ * disk_writev(); only a partial last sector is read first.  Returns
+ * the number of bytes actually written, which is less than SIZE past
+ * end of file, or zero if writes are denied or memory is short. */
+off_t
+inode_write_pages (struct inode *inode, const void *pages[], off_t size,
+		off_t offset) {
+	const void **burst;
+	uint8_t *bounce;
+	off_t bytes_written = 0;
+#ifdef VM
+	off_t i;
+#endif
 
+	ASSERT (offset % DISK_SECTOR_SIZE == 0);
+
+	if (inode->deny_write_cnt || offset >= inode_length (inode))
+		return 0;
+	if (size > inode_length (inode) - offset)
+		size = inode_length (inode) - offset;
+	burst = malloc (DISK_BURST_MAX * sizeof *burst);
+	if (burst == NULL)
+		return 0;
+
+	while (bytes_written < size) {
+		disk_sector_t sector_idx = byte_to_sector (inode,
+				offset + bytes_written);
+		size_t cnt = 0;
+
+		while (cnt < DISK_BURST_MAX
+				&& size - bytes_written >= DISK_SECTOR_SIZE) {
+			burst[cnt++] = (const uint8_t *) pages[bytes_written / PGSIZE]
+				+ bytes_written % PGSIZE;
+			bytes_written += DISK_SECTOR_SIZE;
+		}
+		if (cnt > 0) {
+			disk_writev (filesys_disk, sector_idx, cnt, burst);
+			continue;
+		}
+
+		/* A partial last sector: keep what follows it.  The pointer
+		 * array has room to serve as the bounce buffer. */
+		bounce = (uint8_t *) burst;
+		disk_read (filesys_disk, sector_idx, bounce);
+		memcpy (bounce, (const uint8_t *) pages[bytes_written / PGSIZE]
+				+ bytes_written % PGSIZE, size - bytes_written);
+		disk_write (filesys_disk, sector_idx, bounce);
+		bytes_written = size;
+	}
+	free (burst);
+#ifdef USERPROG
+	if (bytes_written > 0 && inode->exec_cached)
+		exec_cache_invalidate (inode);
+#endif
+#ifdef VM
+	/* Keep the mapped pages of the file up to date. */
+	for (i = 0; i < bytes_written; i += PGSIZE)
+		filemap_write (inode, offset + i, pages[i / PGSIZE],
+				bytes_written - i < PGSIZE ? bytes_written - i : PGSIZE);
+#endif
 	return bytes_written;
 }
 
@@ -0,0 +1,51 @@
+#ifndef __LIB_FAULT_STATS_H
+#define __LIB_FAULT_STATS_H
+
+#include <stdint.h>
+
+/* How a page fault was served.  The first three kinds are minor: they
+ * need no I/O.  The others are major. */
+enum fault_kind {
+	FAULT_ZERO,                 /* Page of zeros. */
+	FAULT_RESIDENT,             /* Already in memory, e.g. page cache. */
+	FAULT_COW,                  /* Write to a copy-on-write page. */
+	FAULT_FILE,                 /* Read from a file. */
+	FAULT_SWAP,                 /* Read from swap or zswap. */
+	FAULT_KIND_CNT
+};
+
+#define FAULT_IS_MAJOR(KIND) ((KIND) >= FAULT_FILE)
+
+/* Faults are also counted by VM type of the page: VM_ANON, VM_FILE
+ * and VM_PAGE_CACHE, in that order. */
+#define FAULT_TYPE_CNT 3
+
+/* Latency histograms, in TSC cycles.  Bucket 0 counts the faults that
+ * took fewer than 2^(FAULT_HIST_SHIFT + 1) cycles, bucket I > 0 those
+ * that took [2^(FAULT_HIST_SHIFT + I), 2^(FAULT_HIST_SHIFT + I + 1)),
+ * and the last bucket everything longer. */
+#define FAULT_HIST_SHIFT 9
+#define FAULT_HIST_BUCKETS 16
+
+/* Faulting instructions reported, most frequent first. */
+#define FAULT_TOP_CNT 8
+
+/* Page fault statistics, as returned by the fault_stats() system
+ * call. */
+struct fault_stats {
+	/* The calling process. */
+	long long minor_cnt;
+	long long major_cnt;
+
+	/* The whole system, since boot. */
+	long long kind_cnt[FAULT_KIND_CNT];
+	long long kind_cycles[FAULT_KIND_CNT];      /* Total latency. */
+	long long kind_hist[FAULT_KIND_CNT][FAULT_HIST_BUCKETS];
+	long long type_hist[FAULT_TYPE_CNT][FAULT_HIST_BUCKETS];
+	struct {
+		uintptr_t rip;                          /* Instruction, or 0. */
+		long long cnt;                          /* Faults it took. */
+	} top[FAULT_TOP_CNT];
+};
+
+#endif /* lib/fault-stats.h */
@@ -0,0 +1,21 @@
+#ifndef __LIB_KERNEL_LZ4_H
+#define __LIB_KERNEL_LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* LZ4 block compression.
+
+   The output is an LZ4 block: a sequence of literal runs and
+   back-references of at most 64 kB.  There is no frame header, so
+   the caller must remember the compressed length. */
+
+/* Bytes of scratch memory lz4_compress() needs. */
+#define LZ4_WORK_SIZE (sizeof (uint16_t) << 12)
+
+size_t lz4_compress (const void *src, size_t src_len,
+		void *dst, size_t dst_cap, void *work);
+size_t lz4_decompress (const void *src, size_t src_len,
+		void *dst, size_t dst_cap);
+
+#endif /* lib/kernel/lz4.h */
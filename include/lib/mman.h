@@ -0,0 +1,36 @@
+#ifndef __LIB_MMAN_H
+#define __LIB_MMAN_H
+
+/* Memory mapping flags and advice, shared by the kernel and user
+ * programs. */
+
+/* Flags for mmap(), given in the bits of its WRITABLE argument above
+ * the boolean, as in "true | MAP_ANONYMOUS". */
+#define MAP_POPULATE 0x100      /* Load every page of the mapping right
+                                   away instead of on first touch. */
+#define MAP_ANONYMOUS 0x200     /* Map zeros rather than a file, whose FD
+                                   is then ignored.  A null ADDR lets the
+                                   kernel choose where. */
+
+/* Returned by mmap() on failure. */
+#define MAP_FAILED ((void *) NULL)
+
+/* Returned by sbrk() on failure. */
+#define SBRK_FAILED ((void *) -1)
+
+/* Advice for madvise(). */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_RANDOM 1           /* Expect random accesses: no read-ahead. */
+#define MADV_SEQUENTIAL 2       /* Expect sequential reads: read far ahead,
+                                   and drop what was read early. */
+#define MADV_WILLNEED 3         /* Expect accesses soon: read in now. */
+#define MADV_DONTNEED 4         /* Drop the pages now; they read back from
+                                   their file, or as zeros. */
+#define MADV_FREE 5             /* Anonymous pages may be dropped instead
+                                   of swapped, unless written again. */
+
+/* Flags for msync(), one of which must be given. */
+#define MS_ASYNC 1              /* Write back when convenient. */
+#define MS_SYNC 4               /* Write back before returning. */
+
+#endif /* lib/mman.h */
@@ -0,0 +1,22 @@
+#ifndef __LIB_SPAWN_H
+#define __LIB_SPAWN_H
+
+/* File descriptor actions for spawn(), carried out in order in the
+ * new process before it starts running its program. */
+enum spawn_action_type {
+	SPAWN_CLOSE,                /* Close FD. */
+	SPAWN_DUP2,                 /* Make NEWFD a copy of FD. */
+	SPAWN_OPEN,                 /* Open PATH as FD. */
+};
+
+struct spawn_action {
+	int type;                   /* One of SPAWN_*. */
+	int fd;
+	int newfd;                  /* SPAWN_DUP2 only. */
+	const char *path;           /* SPAWN_OPEN only. */
+};
+
+/* Most actions one spawn() may take. */
+#define SPAWN_ACTIONS_MAX 16
+
+#endif /* lib/spawn.h */
@@ -36,6 +36,24 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Virtual memory extras. */
+	SYS_RSS_LIMIT,              /* Set the resident set limits. */
+	SYS_MADVISE,                /* Advise on the use of a memory range. */
+	SYS_FAULT_STATS,            /* Read page fault statistics. */
+
+	/* Process creation extras. */
+	SYS_SPAWN,                  /* Start a program in a new process. */
+	SYS_VFORK,                  /* Fork, borrowing the address space. */
+
+	/* Heap extras. */
+	SYS_SBRK,                   /* Move the program break. */
+
+	/* Mapping extras. */
+	SYS_MSYNC,                  /* Write back a range of mappings. */
+
+	/* Stack extras. */
+	SYS_STACK_LIMIT,            /* Set the stack size limit. */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -4,6 +4,11 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <fault-stats.h>
+#include <mman.h>
+#include <spawn.h>
+#include <syscall-nr.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -11,7 +16,6 @@ typedef int pid_t;
 
 /* Map region identifier. */
 typedef int off_t;
-#define MAP_FAILED ((void *) NULL)
 
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
@@ -37,10 +41,18 @@ unsigned tell (int fd);
 void close (int fd);
 
 int dup2(int oldfd, int newfd);
+pid_t spawn (const char *path, char *const argv[],
+		const struct spawn_action *actions, size_t action_cnt);
 
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+void *sbrk (intptr_t increment);
+bool madvise (void *addr, size_t length, int advice);
+bool msync (void *addr, size_t length, int flags);
+bool rss_limit (size_t soft_pages, size_t hard_pages);
+bool stack_limit (size_t bytes);
+bool fault_stats (struct fault_stats *stats);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -58,6 +70,22 @@ static inline void* get_phys_addr (void *user_addr) {
 	return pa;
 }
 
+/* Creates a child that runs in this process's memory, on its stack,
+ * until it calls exec() or exit(); this process waits until then.
+ * Returns 0 in the child and its pid in the parent.  Inlined, so that
+ * the child returns into the caller without a stack frame of its own
+ * that the parent would later return through. */
+static inline __attribute__((always_inline)) pid_t
+vfork (void) {
+	long long ret;
+
+	asm volatile ("syscall"
+			: "=a" (ret)
+			: "a" ((long long) SYS_VFORK)
+			: "rcx", "r11", "memory", "cc");
+	return ret;
+}
+
 static inline long long
 get_fs_disk_read_cnt (void) {
 	long long read_cnt;
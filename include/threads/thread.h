@@ -5,6 +5,7 @@
 #include <list.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
+#include "threads/synch.h"
 #ifdef VM
 #include "vm/vm.h"
 #endif
@@ -107,10 +108,35 @@ struct thread
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4; /* Page map level 4 */
+	struct thread *vfork_parent; /* Process whose address space we
+	                                borrow since vfork(), or NULL. */
+	struct semaphore vfork_sema; /* Upped when our vfork() child gives
+	                                our address space back. */
+	struct list children;        /* Exit records of our children. */
+	struct exit_record *exit_rec;/* Ours, shared with our parent. */
+	int exit_status;             /* Passed to exit(), or -1. */
+	struct fd_table *fds;        /* Open file descriptors. */
+	struct file *exec_file;      /* Our executable, kept unwritable. */
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+
+	/* Resident set, owned by vm/rss.c. */
+	size_t rss;                /* Pages mapped to frames. */
+	size_t rss_soft;           /* Reclaim prefers us above this. */
+	size_t rss_hard;           /* We never grow above this. */
+	size_t wss;                /* Estimated working set, in pages. */
+	size_t wss_acc;            /* Working set being sampled. */
+	bool rss_over;             /* Over the soft limit or working set? */
+
+	/* Page faults served, owned by vm/fault.c. */
+	long long minor_faults;    /* Without I/O. */
+	long long major_faults;    /* From a file or swap. */
+
+	/* User stack pointer at the last system call, owned by
+	 * userprog/syscall.c. */
+	uintptr_t user_rsp;
 #endif
 
 	/* Owned by thread.c. */
@@ -138,6 +164,10 @@ void thread_print_stats(void);
 typedef void thread_func(void *aux);
 tid_t thread_create(const char *name, int priority, thread_func *, void *);
 
+/* Performs some operation on thread t, given auxiliary data AUX. */
+typedef void thread_action_func (struct thread *t, void *aux);
+void thread_foreach (thread_action_func *, void *);
+
 void thread_block(void);
 void thread_unblock(struct thread *);
 
@@ -0,0 +1,41 @@
+#ifndef USERPROG_EXEC_CACHE_H
+#define USERPROG_EXEC_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct inode;
+
+/* Most loadable segments an executable may have. */
+#define EXEC_SEGMENTS_MAX 16
+
+/* A validated loadable segment, with the arguments load_segment()
+ * takes. */
+struct exec_segment {
+	off_t ofs;                    /* File offset of its first page. */
+	uintptr_t upage;              /* Its first user page. */
+	uint32_t read_bytes;          /* Bytes read from the file... */
+	uint32_t zero_bytes;          /* ...followed by these zeros. */
+	bool writable;
+};
+
+/* The layout of an executable, as load() builds it from the ELF
+ * headers. */
+struct exec_image {
+	uintptr_t entry;              /* Entry point. */
+	size_t seg_cnt;               /* Loadable segments. */
+	struct exec_segment segs[EXEC_SEGMENTS_MAX];
+};
+
+void exec_cache_init (void);
+bool exec_cache_lookup (struct inode *inode, struct exec_image *image,
+		unsigned *gen);
+void exec_cache_insert (struct inode *inode, const struct exec_image *image,
+		unsigned gen);
+bool exec_cache_contains (struct inode *inode);
+void exec_cache_invalidate (struct inode *inode);
+void exec_cache_print_stats (void);
+
+#endif /* userprog/exec_cache.h */
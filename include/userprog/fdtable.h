@@ -0,0 +1,35 @@
+#ifndef USERPROG_FDTABLE_H
+#define USERPROG_FDTABLE_H
+
+#include <stdbool.h>
+
+struct file;
+
+/* Most file descriptors a process may have open at once. */
+#define FD_MAX 128
+
+/* An open file, shared by the descriptors that dup2() made copies of
+ * one another, so that they also share its position. */
+struct open_file {
+	struct file *file;            /* Null for the console. */
+	int console;                  /* STDIN_FILENO or STDOUT_FILENO if
+	                                 FILE is null. */
+	int ref_cnt;                  /* Descriptors referring to it. */
+};
+
+/* The file descriptors of a process.  Only the process itself uses
+ * it, so it needs no lock. */
+struct fd_table {
+	struct open_file *files[FD_MAX];
+};
+
+struct fd_table *fd_table_create (void);
+struct fd_table *fd_table_duplicate (const struct fd_table *);
+void fd_table_destroy (struct fd_table *);
+struct open_file *fd_lookup (struct fd_table *, int fd);
+struct file *fd_file (struct fd_table *, int fd);
+int fd_install (struct fd_table *, struct file *);
+bool fd_close (struct fd_table *, int fd);
+int fd_dup2 (struct fd_table *, int oldfd, int newfd);
+
+#endif /* userprog/fdtable.h */
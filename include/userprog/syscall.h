@@ -1,6 +1,11 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include "threads/synch.h"
+
+/* Serializes the file system calls of all processes. */
+extern struct lock filesys_lock;
+
 void syscall_init (void);
 
 #endif /* userprog/syscall.h */
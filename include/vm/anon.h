@@ -1,13 +1,44 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
 #include "vm/vm.h"
+struct frame;
 struct page;
+struct zswap_entry;
 enum vm_type;
 
+/* Most pages reclaimed together and written to swap as one burst. */
+#define SWAP_CLUSTER 16
+
 struct anon_page {
+	size_t slot;            /* Swap slot holding the page, or SWAP_NONE. */
+	struct zswap_entry *zentry;  /* Compressed copy in zswap, or NULL. */
+	bool lazy_free;         /* May be dropped rather than swapped if not
+	                           written since?  See MADV_FREE. */
+};
+
+#define SWAP_NONE ((size_t) -1)
+
+/* An anonymous frame being evicted.  See anon_swap_out_cluster(). */
+struct anon_evict {
+	struct frame *frame;          /* The frame. */
+	void *kva;                    /* Its contents. */
+	struct vm_area *area;         /* Area and address of its first page, */
+	void *va;                     /*   which decide its slot. */
+	bool shared;                  /* Mapped by more than one page? */
+	size_t slot;                  /* Slot of the copy on disk, */
+	struct zswap_entry *zentry;   /*   or in zswap; neither for zeros. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_evict_init (struct anon_evict *ev, struct frame *frame);
+bool anon_swap_out_cluster (struct anon_evict evicts[], size_t cnt);
+void anon_evict_attach (struct anon_evict *ev);
+void anon_evict_cancel (struct anon_evict *ev);
+bool anon_share (struct page *page, struct page *src);
+void anon_discard (struct page *page);
+bool anon_is_zero (struct page *page);
+void anon_print_stats (void);
 
 #endif
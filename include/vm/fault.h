@@ -0,0 +1,15 @@
+#ifndef VM_FAULT_H
+#define VM_FAULT_H
+#include <fault-stats.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+enum vm_type;
+
+void fault_init (void);
+void fault_record (enum fault_kind kind, enum vm_type type, uintptr_t rip,
+		uint64_t cycles);
+bool fault_get_stats (struct fault_stats *out);
+void fault_print_stats (void);
+
+#endif /* vm/fault.h */
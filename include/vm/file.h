@@ -4,9 +4,13 @@
 #include "vm/vm.h"
 
 struct page;
+struct vm_area;
 enum vm_type;
 
 struct file_page {
+	struct file *file;            /* The area's file handle. */
+	off_t offset;                 /* File offset of this page. */
+	size_t read_bytes;            /* Bytes read from FILE; rest is zero. */
 };
 
 void vm_file_init (void);
@@ -14,4 +18,6 @@ bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+void file_sync (struct vm_area *area, void *start, void *end);
+void file_print_stats (void);
 #endif
@@ -0,0 +1,20 @@
+#ifndef VM_FILEMAP_H
+#define VM_FILEMAP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct frame;
+struct inode;
+
+void filemap_init (void);
+struct frame *filemap_find (struct inode *inode, size_t index);
+bool filemap_contains (struct inode *inode, size_t index);
+bool filemap_add (struct inode *inode, size_t index, struct frame *frame);
+void filemap_remove (struct frame *frame);
+void filemap_write (struct inode *inode, off_t ofs, const void *buf,
+		size_t size);
+void filemap_forget_inode (struct inode *inode);
+void filemap_print_stats (void);
+
+#endif /* vm/filemap.h */
@@ -0,0 +1,29 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct frame;
+struct page;
+struct thread;
+
+void frame_table_init (void);
+void frame_table_lock (void);
+void frame_table_unlock (void);
+void frame_table_wait (void);
+void frame_table_wake (void);
+void frame_table_insert (struct frame *frame);
+void frame_table_remove (struct frame *frame);
+struct frame *frame_table_victim (struct thread *owner);
+void frame_table_keep (struct frame *frame);
+void frame_table_deactivate (struct frame *frame);
+void frame_table_add_split (struct frame *frame, const struct frame *head);
+typedef void frame_scan_func (struct frame *frame, void *aux);
+bool frame_table_scan (size_t cnt, frame_scan_func *func, void *aux);
+void frame_table_for_each (frame_scan_func *func, void *aux);
+void frame_table_print_stats (void);
+
+void frame_pin (struct frame *frame);
+void frame_unpin (struct frame *frame);
+
+#endif /* vm/frame.h */
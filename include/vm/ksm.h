@@ -0,0 +1,13 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+
+struct frame;
+
+/* Frames that ksmd scans per wake-up; 0 disables merging. */
+extern int ksm_pages_to_scan;
+
+void ksm_init (void);
+void ksm_forget (struct frame *frame);
+void ksm_print_stats (void);
+
+#endif /* vm/ksm.h */
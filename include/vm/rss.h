@@ -0,0 +1,19 @@
+#ifndef VM_RSS_H
+#define VM_RSS_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct frame;
+struct thread;
+
+void rss_init (void);
+void rss_charge (struct thread *t);
+void rss_uncharge (struct thread *t);
+bool rss_over (const struct thread *t);
+bool rss_any_over (void);
+bool rss_at_hard_limit (const struct thread *t);
+bool rss_set_limit (size_t soft, size_t hard);
+void rss_inherit (struct thread *child, const struct thread *parent);
+void rss_print_stats (void);
+
+#endif /* vm/rss.h */
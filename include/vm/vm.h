@@ -1,6 +1,9 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <stdint.h>
+#include <hash.h>
+#include <list.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -19,11 +22,19 @@ enum vm_type {
 	 * markers, until the value is fit in the int. */
 	VM_MARKER_0 = (1 << 3),
 	VM_MARKER_1 = (1 << 4),
+	VM_MARKER_2 = (1 << 5),
 
 	/* DO NOT EXCEED THIS VALUE. */
 	VM_MARKER_END = (1 << 31),
 };
 
+/* Marks the area that holds the user stack. */
+#define VM_STACK VM_MARKER_0
+/* Marks the heap, grown and shrunk by sbrk(). */
+#define VM_HEAP VM_MARKER_1
+/* Marks an area made by mmap(), which munmap() may remove. */
+#define VM_MMAP VM_MARKER_2
+
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
@@ -33,6 +44,7 @@ enum vm_type {
 
 struct page_operations;
 struct thread;
+struct huge_page;
 
 #define VM_TYPE(type) ((type) & 7)
 
@@ -46,6 +58,12 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem;    /* Element in the owner's SPT. */
+	struct list_elem area_elem;   /* Element in AREA's page list. */
+	struct list_elem frame_elem;  /* Element in FRAME's page list. */
+	struct vm_area *area;         /* Area this page lies in, or NULL. */
+	struct thread *owner;         /* Process whose SPT holds this page. */
+	bool writable;                /* Mapped read/write? */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -62,7 +80,35 @@ struct page {
 /* The representation of "frame" */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;            /* One of PAGES, or NULL if none. */
+	struct list pages;            /* Pages mapped to this frame. */
+	int map_cnt;                  /* Length of PAGES; > 1 if copy-on-write. */
+
+	/* Frame table state, owned by vm/frame.c. */
+	struct list_elem clock_elem;  /* Position on the clock. */
+	bool linked;                  /* On the clock? */
+	bool hot;                     /* Hot, or cold? */
+	bool test;                    /* Cold and in its test period? */
+	bool fresh;                   /* Not referenced since it was loaded? */
+	int pin_cnt;                  /* Not evictable while nonzero. */
+	bool evicting;                /* Being written out, with the frame
+	                                 table lock released? */
+	bool accessed;                /* Accessed bit saved by vm/rss.c. */
+	uint8_t idle_age;             /* Working set sweeps since last use. */
+
+	/* Same-page merging state, owned by vm/ksm.c. */
+	struct hash_elem ksm_elem;    /* Element in the (un)stable table. */
+	uint64_t ksm_sum;             /* Content hash at the last visit. */
+	bool ksm_stable;              /* Merged, in the stable table? */
+	bool ksm_unstable;            /* A candidate, in the unstable table? */
+
+	/* Page cache state, owned by vm/filemap.c. */
+	struct file_mapping *mapping; /* Cache holding this frame, or NULL. */
+	size_t index;                 /* Page number in the cached file. */
+
+	/* 2 MiB mapping this frame is part of, or NULL.  Only its first
+	 * frame is on the clock; see huge_fault() in vm.c. */
+	struct huge_page *huge;
 };
 
 /* The function table for page operations.
@@ -81,12 +127,49 @@ struct page_operations {
 #define destroy(page) \
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
+/* A virtual memory area: a page-aligned range of the address space
+ * whose pages share one set of attributes (an ELF segment, the stack,
+ * one mmap).  Creating an area costs O(1) no matter how large it is;
+ * a `struct page' is only created for a page of the area when it is
+ * first touched. */
+struct vm_area {
+	void *start;                  /* First page. */
+	void *end;                    /* One past the last page. */
+	enum vm_type type;            /* VM_ANON or VM_FILE, plus markers. */
+	bool writable;                /* May the pages be written? */
+	vm_initializer *init;         /* Fills a page on first touch, or NULL
+	                                 for zero-fill.  Gets the area as AUX. */
+	struct file *file;            /* Backing file (own handle), or NULL. */
+	off_t offset;                 /* File offset of START. */
+	size_t read_bytes;            /* File bytes from START; rest is zero. */
+	struct list pages;            /* Pages of the area that exist. */
+	size_t fault_window;          /* Pages mapped per fault, fault-around. */
+	void *last_fault;             /* Address of the last read fault. */
+	int advice;                   /* MADV_NORMAL, _RANDOM or _SEQUENTIAL. */
+
+	/* Interval tree links, owned by vm/area.c. */
+	struct vm_area *left, *right;
+	int height;
+};
+
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+ * Two levels: a balanced tree of non-overlapping areas, looked up in
+ * O(log #areas), and a hash of the pages that have been touched. */
 struct supplemental_page_table {
+	bool active;                  /* Initialized and not yet killed? */
+	struct vm_area *areas;        /* Root of the area tree. */
+	struct hash pages;            /* Existing pages, keyed by va. */
+	uint8_t *heap_start;          /* Start of the heap, or NULL. */
+	uint8_t *brk;                 /* Program break: the heap ends here. */
+	size_t stack_limit;           /* Most bytes the stack may grow to. */
 };
 
+/* Stack limit of a new process. */
+#define STACK_LIMIT_DEFAULT (1 << 20)
+
+/* Pages the stack grows by at once. */
+extern int stack_chunk_pages;
+
 #include "threads/thread.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
@@ -97,7 +180,30 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
+bool spt_insert_area (struct supplemental_page_table *spt,
+		struct vm_area *area);
+void spt_remove_area (struct supplemental_page_table *spt,
+		struct vm_area *area);
+struct vm_area *spt_find_area (struct supplemental_page_table *spt,
+		const void *va);
+struct vm_area *spt_find_overlap (struct supplemental_page_table *spt,
+		const void *start, const void *end);
+typedef bool area_action_func (struct vm_area *area, void *aux);
+bool spt_for_each_area (struct supplemental_page_table *spt,
+		area_action_func *action, void *aux);
+
+struct vm_area *vm_area_add (struct supplemental_page_table *spt,
+		void *start, void *end, enum vm_type type, bool writable,
+		vm_initializer *init, struct file *file, off_t offset,
+		size_t read_bytes);
+void vm_area_destroy (struct supplemental_page_table *spt,
+		struct vm_area *area);
+size_t vm_area_read_bytes (const struct vm_area *area, const void *va,
+		off_t *ofs);
+
 void vm_init (void);
+struct thread *vm_owner (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -107,6 +213,20 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+struct frame *vm_readahead_frame (void);
+void vm_readahead_release (struct frame *frame);
+bool vm_install_page (struct page *page, struct frame *frame);
+void vm_merge_frame (struct frame *dup, struct frame *frame);
+void vm_free_frame (struct page *page);
+struct frame *vm_page_frame (struct page *page);
+void vm_populate (struct vm_area *area);
+bool vm_madvise (void *addr, size_t length, int advice);
+bool vm_msync (void *addr, size_t length, int flags);
+bool vm_set_stack_limit (size_t limit);
+void vm_heap_init (void *base);
+void *vm_sbrk (intptr_t increment);
+void *vm_find_unmapped (size_t length);
+bool vm_user_range_ok (const void *uaddr, size_t size, bool write);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
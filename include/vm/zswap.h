@@ -0,0 +1,22 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct page;
+struct zswap_entry;
+
+/* Most of RAM, in percent, the compressed pool may use. */
+extern int zswap_max_percent;
+
+void zswap_init (void);
+struct zswap_entry *zswap_store (const void *kva);
+void zswap_attach (struct zswap_entry *entry, struct page *page);
+void zswap_load (struct zswap_entry *entry, void *kva);
+void zswap_free (struct zswap_entry *entry);
+bool zswap_full (void);
+size_t zswap_oldest (struct zswap_entry *entries[], size_t cnt);
+struct page *zswap_page (struct zswap_entry *entry);
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */
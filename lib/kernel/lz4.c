@@ -0,0 +1,182 @@
+#include "lz4.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* An LZ4 block is a series of sequences.  Each sequence is a token
+   byte, whose high nibble is a literal count and whose low nibble is
+   a match length minus MIN_MATCH, followed by any extension bytes of
+   the literal count, the literals, a 2-byte little-endian match
+   offset, and any extension bytes of the match length.  A nibble of
+   15 is extended by bytes that are added to it, up to and including
+   the first byte that is not 255.  The last sequence has literals
+   only.
+
+   The format requires the last LAST_LITERALS bytes to be literals
+   and no match to start within MATCH_LIMIT bytes of the end. */
+#define MIN_MATCH 4
+#define LAST_LITERALS 5
+#define MATCH_LIMIT 12
+#define MAX_OFFSET 65535
+
+#define HASH_BITS 12
+
+/* Output cursor that refuses to run past its end. */
+struct out {
+	uint8_t *p;
+	uint8_t *end;
+};
+
+static uint32_t
+read32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+static unsigned
+hash4 (uint32_t v) {
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static bool
+put_byte (struct out *o, uint8_t b) {
+	if (o->p >= o->end)
+		return false;
+	*o->p++ = b;
+	return true;
+}
+
+/* Writes the extension bytes of a nibble that overflowed by N. */
+static bool
+put_length (struct out *o, size_t n) {
+	for (; n >= 255; n -= 255)
+		if (!put_byte (o, 255))
+			return false;
+	return put_byte (o, n);
+}
+
+/* Writes a sequence of the LIT_CNT literals at LIT, followed, if
+   MATCH_LEN is nonzero, by a match of MATCH_LEN bytes at OFFSET. */
+static bool
+put_sequence (struct out *o, const uint8_t *lit, size_t lit_cnt,
+		size_t offset, size_t match_len) {
+	size_t m = match_len != 0 ? match_len - MIN_MATCH : 0;
+
+	if (!put_byte (o, (lit_cnt < 15 ? lit_cnt : 15) << 4 | (m < 15 ? m : 15)))
+		return false;
+	if (lit_cnt >= 15 && !put_length (o, lit_cnt - 15))
+		return false;
+	if ((size_t) (o->end - o->p) < lit_cnt)
+		return false;
+	memcpy (o->p, lit, lit_cnt);
+	o->p += lit_cnt;
+	if (match_len == 0)
+		return true;
+	if (!put_byte (o, offset & 0xff) || !put_byte (o, offset >> 8))
+		return false;
+	return m < 15 || put_length (o, m - 15);
+}
+
+/* Compresses the SRC_LEN bytes at SRC into DST, which has room for
+   DST_CAP bytes, using WORK, LZ4_WORK_SIZE bytes of scratch memory.
+   Returns the compressed length, or 0 if it would exceed DST_CAP.
+   SRC_LEN must not exceed 64 kB. */
+size_t
+lz4_compress (const void *src_, size_t src_len,
+		void *dst, size_t dst_cap, void *work) {
+	const uint8_t *src = src_;
+	uint16_t *table = work;
+	struct out o = { dst, (uint8_t *) dst + dst_cap };
+	size_t ip = 0, anchor = 0;
+
+	ASSERT (src_len <= 65536);
+
+	memset (table, 0, LZ4_WORK_SIZE);
+	if (src_len > MATCH_LIMIT) {
+		size_t limit = src_len - MATCH_LIMIT;
+
+		while (ip < limit) {
+			uint32_t seq = read32 (src + ip);
+			unsigned h = hash4 (seq);
+			size_t ref = table[h];
+			size_t len;
+
+			table[h] = ip;
+			if (ref >= ip || ip - ref > MAX_OFFSET
+					|| read32 (src + ref) != seq) {
+				ip++;
+				continue;
+			}
+
+			len = MIN_MATCH;
+			while (ip + len < src_len - LAST_LITERALS
+					&& src[ref + len] == src[ip + len])
+				len++;
+			if (!put_sequence (&o, src + anchor, ip - anchor, ip - ref, len))
+				return 0;
+			ip += len;
+			anchor = ip;
+		}
+	}
+	if (!put_sequence (&o, src + anchor, src_len - anchor, 0, 0))
+		return 0;
+	return o.p - (uint8_t *) dst;
+}
+
+/* Reads a length nibble of value N and its extension bytes from
+   *P, which must not pass END.  Returns false if the input ends
+   first. */
+static bool
+get_length (const uint8_t **p, const uint8_t *end, size_t *n) {
+	uint8_t b;
+
+	if (*n != 15)
+		return true;
+	do {
+		if (*p >= end)
+			return false;
+		b = *(*p)++;
+		*n += b;
+	} while (b == 255);
+	return true;
+}
+
+/* Decompresses the SRC_LEN-byte LZ4 block at SRC into DST, which
+   has room for DST_CAP bytes.  Returns the decompressed length, or
+   0 if the block is malformed or does not fit. */
+size_t
+lz4_decompress (const void *src_, size_t src_len,
+		void *dst_, size_t dst_cap) {
+	const uint8_t *ip = src_, *end = ip + src_len;
+	uint8_t *dst = dst_, *op = dst, *op_end = dst + dst_cap;
+
+	while (ip < end) {
+		uint8_t token = *ip++;
+		size_t lit = token >> 4, len = token & 15, offset;
+
+		if (!get_length (&ip, end, &lit)
+				|| lit > (size_t) (end - ip) || lit > (size_t) (op_end - op))
+			return 0;
+		memcpy (op, ip, lit);
+		ip += lit;
+		op += lit;
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return 0;
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (!get_length (&ip, end, &len))
+			return 0;
+		len += MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (op - dst)
+				|| len > (size_t) (op_end - op))
+			return 0;
+		/* The match may overlap its own output, so copy bytewise. */
+		for (; len > 0; len--, op++)
+			*op = op[-offset];
+	}
+	return op - dst;
+}
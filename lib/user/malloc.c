@@ -0,0 +1,408 @@
+#include <malloc.h>
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A malloc() for user programs.
+
+   A small request, up to SMALL_MAX bytes, is rounded up to one of
+   CLASS_CNT size classes.  Blocks of a class are carved out of
+   "spans": SPAN_SIZE-aligned pieces of the heap, obtained with
+   sbrk(), that start with a struct span and hold blocks of a single
+   class.  A span hands out blocks it never handed out before in
+   address order, so that its pages are only touched when needed, and
+   keeps the blocks given back to it on a free list.
+
+   In front of the spans, each class has a cache of free blocks, from
+   which malloc() takes and to which free() gives back in O(1) without
+   looking at the span.  A process has a single thread, so the cache
+   plays the part of a thread cache and needs no locking.  An empty
+   cache is refilled with a batch of blocks from the class's spans; a
+   cache that grows past twice the batch size gives a batch back.
+
+   A span whose blocks are all free again goes back to the kernel: at
+   the top of the heap through sbrk(), elsewhere through
+   madvise(MADV_FREE) of all but its first page, which keeps the
+   span on a list for reuse.
+
+   A larger request gets an anonymous mapping of its own, behind a
+   struct big header, which is unmapped when the block is freed.
+
+   Mappings never overlap the heap, so a block is small if and only if
+   it lies in [heap_lo, heap_hi), and its span is then found by
+   rounding its address down to SPAN_SIZE.  A program that uses
+   malloc() must not move the program break itself. */
+
+#define PAGE_SIZE 4096
+#define SPAN_SIZE (4 * PAGE_SIZE)
+#define SMALL_MAX 4096
+
+/* Block sizes of the size classes.  Every size is a multiple of 16,
+   so that blocks are as aligned as any object needs. */
+static const unsigned short class_size[] = {
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256, 320, 384, 448, 512,
+	640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+	2560, 3072, 3584, 4096,
+};
+#define CLASS_CNT (sizeof class_size / sizeof *class_size)
+
+/* Marks a span with no class, on FREE_SPANS. */
+#define CLASS_NONE 0xffff
+
+/* Span header. */
+struct span {
+	struct span *prev, *next;   /* In PARTIAL[CLS] or FREE_SPANS. */
+	bool listed;                /* In one of the lists? */
+	unsigned short cls;         /* Size class, or CLASS_NONE. */
+	unsigned short used;        /* Blocks handed out, cached or in use. */
+	void *free;                 /* Blocks given back, linked through
+	                               their first word. */
+	char *fresh;                /* Blocks never handed out start here. */
+};
+#define SPAN_HDR ROUND_UP (sizeof (struct span), 16)
+
+/* Magic number for detecting corruption of a big block. */
+#define BIG_MAGIC 0x6d616c6cUL
+
+/* Header of a big block, in front of it in its own mapping. */
+struct big {
+	size_t map_size;            /* Bytes mapped, header included. */
+	size_t magic;               /* Always BIG_MAGIC. */
+};
+
+/* Free blocks cached for a size class. */
+struct cache {
+	void *head;                 /* Linked through their first word. */
+	unsigned cnt;
+};
+
+static struct cache caches[CLASS_CNT];
+static struct span *partial[CLASS_CNT];   /* Spans with blocks to give. */
+static struct span *free_spans;           /* Spans with no class. */
+static char *heap_lo, *heap_hi;           /* Spans lie in here. */
+
+/* Size class of each size, in units of 16 bytes, up to SMALL_MAX. */
+static unsigned char size_class[SMALL_MAX / 16 + 1];
+static bool inited;
+
+static void
+malloc_init (void) {
+	size_t i, cls = 0;
+
+	for (i = 0; i <= SMALL_MAX / 16; i++) {
+		while (class_size[cls] < i * 16)
+			cls++;
+		size_class[i] = cls;
+	}
+	inited = true;
+}
+
+/* Returns how many blocks of class CLS move between a cache and the
+   spans at once. */
+static unsigned
+batch_size (size_t cls) {
+	unsigned batch = 8192 / class_size[cls];
+
+	return batch < 2 ? 2 : batch > 32 ? 32 : batch;
+}
+
+static void
+span_push (struct span **list, struct span *s) {
+	s->prev = NULL;
+	s->next = *list;
+	if (*list != NULL)
+		(*list)->prev = s;
+	*list = s;
+	s->listed = true;
+}
+
+static void
+span_unlink (struct span **list, struct span *s) {
+	if (s->prev != NULL)
+		s->prev->next = s->next;
+	else
+		*list = s->next;
+	if (s->next != NULL)
+		s->next->prev = s->prev;
+	s->listed = false;
+}
+
+static struct span *
+span_of (void *block) {
+	return (struct span *) ((uintptr_t) block & ~(uintptr_t) (SPAN_SIZE - 1));
+}
+
+/* Extends the heap by one span and returns it, or a null pointer if
+   the kernel refuses.  Aligns the heap to SPAN_SIZE the first time. */
+static struct span *
+heap_grow (void) {
+	char *s;
+
+	if (heap_lo == NULL) {
+		char *brk = sbrk (0);
+		size_t pad = -(uintptr_t) brk & (SPAN_SIZE - 1);
+
+		if (brk == SBRK_FAILED || sbrk (pad) == SBRK_FAILED)
+			return NULL;
+		heap_lo = heap_hi = brk + pad;
+	}
+	s = sbrk (SPAN_SIZE);
+	if (s == SBRK_FAILED)
+		return NULL;
+	ASSERT (s == heap_hi);
+	heap_hi += SPAN_SIZE;
+	return (struct span *) s;
+}
+
+/* Gives SPAN, none of whose blocks is in use, back to the kernel. */
+static void
+span_release (struct span *s) {
+	struct span *top;
+
+	if (s->listed)
+		span_unlink (&partial[s->cls], s);
+	s->cls = CLASS_NONE;
+	if ((char *) s + SPAN_SIZE != heap_hi) {
+		span_push (&free_spans, s);
+		madvise ((char *) s + PAGE_SIZE, SPAN_SIZE - PAGE_SIZE, MADV_FREE);
+		return;
+	}
+
+	/* Lower the break past S and the free spans right below it. */
+	top = s;
+	do {
+		if (top != s)
+			span_unlink (&free_spans, top);
+		heap_hi -= SPAN_SIZE;
+		top = (struct span *) (heap_hi - SPAN_SIZE);
+	} while (heap_hi > heap_lo && top->cls == CLASS_NONE);
+	sbrk (heap_hi - ((char *) s + SPAN_SIZE));
+}
+
+/* Returns a span of class CLS with blocks to give, or a null pointer
+   if out of memory. */
+static struct span *
+span_get (size_t cls) {
+	struct span *s = partial[cls];
+
+	if (s != NULL)
+		return s;
+	if (free_spans != NULL) {
+		s = free_spans;
+		span_unlink (&free_spans, s);
+	} else if ((s = heap_grow ()) == NULL)
+		return NULL;
+	s->cls = cls;
+	s->used = 0;
+	s->free = NULL;
+	s->fresh = (char *) s + SPAN_HDR;
+	span_push (&partial[cls], s);
+	return s;
+}
+
+/* Takes a block from S, which must have one to give. */
+static void *
+span_take (struct span *s) {
+	size_t size = class_size[s->cls];
+	void *block;
+
+	if (s->free != NULL) {
+		block = s->free;
+		s->free = *(void **) block;
+	} else {
+		block = s->fresh;
+		s->fresh += size;
+	}
+	s->used++;
+	if (s->free == NULL && s->fresh + size > (char *) s + SPAN_SIZE)
+		span_unlink (&partial[s->cls], s);
+	return block;
+}
+
+/* Gives BLOCK back to its span, and the span back to the kernel if
+   that was its last block in use. */
+static void
+span_put (void *block) {
+	struct span *s = span_of (block);
+
+	*(void **) block = s->free;
+	s->free = block;
+	if (--s->used == 0)
+		span_release (s);
+	else if (!s->listed)
+		span_push (&partial[s->cls], s);
+}
+
+/* Moves a batch of blocks of class CLS from the spans into its cache.
+   Returns false if not even one block could be had. */
+static bool
+cache_refill (size_t cls) {
+	struct cache *c = &caches[cls];
+	unsigned i, batch = batch_size (cls);
+
+	for (i = 0; i < batch; i++) {
+		struct span *s = span_get (cls);
+		void *block;
+
+		if (s == NULL)
+			break;
+		block = span_take (s);
+		*(void **) block = c->head;
+		c->head = block;
+		c->cnt++;
+	}
+	return c->head != NULL;
+}
+
+/* Moves a batch of blocks of class CLS from its cache back to the
+   spans. */
+static void
+cache_drain (size_t cls) {
+	struct cache *c = &caches[cls];
+	unsigned i, batch = batch_size (cls);
+
+	for (i = 0; i < batch && c->head != NULL; i++) {
+		void *block = c->head;
+
+		c->head = *(void **) block;
+		c->cnt--;
+		span_put (block);
+	}
+}
+
+/* Maps a big block of SIZE bytes.  Its memory is zeroed. */
+static void *
+big_alloc (size_t size) {
+	struct big *b;
+	size_t map_size;
+
+	if (size > SIZE_MAX - sizeof *b - PAGE_SIZE)
+		return NULL;
+	map_size = ROUND_UP (size + sizeof *b, PAGE_SIZE);
+	b = mmap (NULL, map_size, true | MAP_ANONYMOUS, -1, 0);
+	if (b == MAP_FAILED)
+		return NULL;
+	b->map_size = map_size;
+	b->magic = BIG_MAGIC;
+	return b + 1;
+}
+
+static bool
+is_small (void *block) {
+	return (char *) block >= heap_lo && (char *) block < heap_hi;
+}
+
+/* Returns the header of the big block BLOCK. */
+static struct big *
+big_of (void *block) {
+	struct big *b = (struct big *) block - 1;
+
+	ASSERT (b->magic == BIG_MAGIC);
+	return b;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void *
+malloc (size_t size) {
+	struct cache *c;
+	size_t cls;
+	void *block;
+
+	if (size > SMALL_MAX)
+		return big_alloc (size);
+	if (!inited)
+		malloc_init ();
+
+	cls = size_class[(size + 15) / 16];
+	c = &caches[cls];
+	if (c->head == NULL && !cache_refill (cls))
+		return NULL;
+	block = c->head;
+	c->head = *(void **) block;
+	c->cnt--;
+	return block;
+}
+
+/* Allocates and return A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b) {
+	size_t size = a * b;
+	void *p;
+
+	if (b != 0 && size / b != a)
+		return NULL;
+	p = malloc (size);
+	/* Big blocks are fresh mappings, zeroed by the kernel. */
+	if (p != NULL && size <= SMALL_MAX)
+		memset (p, 0, size);
+	return p;
+}
+
+/* Returns the number of bytes allocated for BLOCK. */
+static size_t
+block_size (void *block) {
+	if (is_small (block))
+		return class_size[span_of (block)->cls];
+	return big_of (block)->map_size - sizeof (struct big);
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly moving it
+   in the process.  If successful, returns the new block; on failure,
+   returns a null pointer.  A call with null OLD_BLOCK is equivalent
+   to malloc(NEW_SIZE).  A call with zero NEW_SIZE is equivalent to
+   free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size) {
+	size_t old_size;
+	void *new_block;
+
+	if (new_size == 0) {
+		free (old_block);
+		return NULL;
+	}
+	if (old_block == NULL)
+		return malloc (new_size);
+
+	/* Stay put unless growing, or shrinking a big block by half. */
+	old_size = block_size (old_block);
+	if (new_size <= old_size
+			&& (is_small (old_block) || new_size > old_size / 2))
+		return old_block;
+
+	new_block = malloc (new_size);
+	if (new_block != NULL) {
+		memcpy (new_block, old_block,
+				old_size < new_size ? old_size : new_size);
+		free (old_block);
+	}
+	return new_block;
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p) {
+	struct cache *c;
+	size_t cls;
+
+	if (p == NULL)
+		return;
+	if (!is_small (p)) {
+		munmap (big_of (p));
+		return;
+	}
+
+	cls = span_of (p)->cls;
+	ASSERT (cls < CLASS_CNT);
+	c = &caches[cls];
+	*(void **) p = c->head;
+	c->head = p;
+	if (++c->cnt > 2 * batch_size (cls))
+		cache_drain (cls);
+}
@@ -54,7 +54,7 @@ static __inline int64_t syscall (uint64_t num_, uint64_t a1_, uint64_t a2_,
 			((uint64_t) ARG2), 0, 0, 0))
 
 #define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3) ( \
-		syscall(((uint64_t *) NUMBER), \
+		syscall(((uint64_t) NUMBER), \
 			((uint64_t) ARG0), \
 			((uint64_t) ARG1), \
 			((uint64_t) ARG2), \
@@ -68,6 +68,7 @@ static __inline int64_t syscall (uint64_t num_, uint64_t a1_, uint64_t a2_,
 			((uint64_t) ARG3), \
 			((uint64_t) ARG4), \
 			0))
+
 void
 halt (void) {
 	syscall0 (SYS_HALT);
@@ -145,6 +146,12 @@ dup2 (int oldfd, int newfd){
 	return syscall2 (SYS_DUP2, oldfd, newfd);
 }
 
+pid_t
+spawn (const char *path, char *const argv[],
+		const struct spawn_action *actions, size_t action_cnt) {
+	return (pid_t) syscall4 (SYS_SPAWN, path, argv, actions, action_cnt);
+}
+
 void *
 mmap (void *addr, size_t length, int writable, int fd, off_t offset) {
 	return (void *) syscall5 (SYS_MMAP, addr, length, writable, fd, offset);
@@ -155,6 +162,36 @@ munmap (void *addr) {
 	syscall1 (SYS_MUNMAP, addr);
 }
 
+void *
+sbrk (intptr_t increment) {
+	return (void *) syscall1 (SYS_SBRK, increment);
+}
+
+bool
+madvise (void *addr, size_t length, int advice) {
+	return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+bool
+msync (void *addr, size_t length, int flags) {
+	return syscall3 (SYS_MSYNC, addr, length, flags);
+}
+
+bool
+rss_limit (size_t soft_pages, size_t hard_pages) {
+	return syscall2 (SYS_RSS_LIMIT, soft_pages, hard_pages);
+}
+
+bool
+stack_limit (size_t bytes) {
+	return syscall1 (SYS_STACK_LIMIT, bytes);
+}
+
+bool
+fault_stats (struct fault_stats *stats) {
+	return syscall1 (SYS_FAULT_STATS, stats);
+}
+
 bool
 chdir (const char *dir) {
 	return syscall1 (SYS_CHDIR, dir);
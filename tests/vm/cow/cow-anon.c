@@ -0,0 +1,46 @@
+/* Checks that fork shares written anonymous pages copy-on-write:
+   the child starts on the parent's frame, gets a copy of its own
+   on its first write, and the parent never sees that write. */
+
+#include <string.h>
+#include <syscall.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+static char buf[PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+	pid_t child;
+	void *pa_parent;
+	void *pa_child;
+
+	memset (buf, 'a', sizeof buf);
+	pa_parent = get_phys_addr (buf);
+	CHECK (pa_parent != 0, "check if page is loaded");
+
+	child = fork ("child");
+	if (child == 0) {
+		CHECK (buf[0] == 'a' && buf[PAGE_SIZE - 1] == 'a',
+				"check data consistency");
+
+		pa_child = get_phys_addr (buf);
+		CHECK (pa_parent == pa_child, "two phys addrs should be the same.");
+
+		memset (buf, 'b', sizeof buf);
+		CHECK (buf[0] == 'b', "check data change");
+
+		pa_child = get_phys_addr (buf);
+		CHECK (pa_parent != pa_child, "two phys addrs should not be the same.");
+		return;
+	}
+	wait (child);
+	CHECK (pa_parent == get_phys_addr (buf), "two phys addrs should be the same.");
+	CHECK (buf[0] == 'a' && buf[PAGE_SIZE - 1] == 'a',
+			"check data consistency");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cow-anon) begin
+(cow-anon) check if page is loaded
+(cow-anon) check data consistency
+(cow-anon) two phys addrs should be the same.
+(cow-anon) check data change
+(cow-anon) two phys addrs should not be the same.
+(cow-anon) end
+(cow-anon) two phys addrs should be the same.
+(cow-anon) check data consistency
+(cow-anon) end
+EOF
+pass;
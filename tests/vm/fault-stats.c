@@ -0,0 +1,35 @@
+/* Touches pages that were never touched before and checks that
+   fault_stats() counts their faults, for the process and for the
+   whole system. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 8
+
+static char buf[PAGE_CNT * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+static struct fault_stats before, after;
+
+void
+test_main (void)
+{
+  size_t i;
+
+  /* Fault in the statistics themselves first. */
+  memset (&after, 0, sizeof after);
+  CHECK (fault_stats (&before), "fault_stats");
+  for (i = 0; i < PAGE_CNT; i++)
+    buf[i * PAGE_SIZE] = 1;
+  CHECK (fault_stats (&after), "fault_stats");
+
+  CHECK (after.minor_cnt - before.minor_cnt >= PAGE_CNT,
+         "check minor fault count");
+  CHECK (after.kind_cnt[FAULT_ZERO] - before.kind_cnt[FAULT_ZERO] >= PAGE_CNT,
+         "check zero fault count");
+  CHECK (after.top[0].rip != 0 && after.top[0].cnt > 0,
+         "check faulting instructions");
+  CHECK (!fault_stats (NULL), "fault_stats of a bad buffer must fail");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fault-stats) begin
+(fault-stats) fault_stats
+(fault-stats) fault_stats
+(fault-stats) check minor fault count
+(fault-stats) check zero fault count
+(fault-stats) check faulting instructions
+(fault-stats) fault_stats of a bad buffer must fail
+(fault-stats) end
+EOF
+pass;
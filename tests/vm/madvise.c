@@ -0,0 +1,48 @@
+/* Drops written pages with MADV_DONTNEED and checks that they read
+   back as zeros, loads a file mapping with MADV_WILLNEED before
+   touching it, and checks that bad arguments are refused. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+static char buf[2 * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  int handle;
+  void *map;
+
+  /* Anonymous pages come back as zeros. */
+  memset (buf, 'x', sizeof buf);
+  CHECK (madvise (buf, sizeof buf, MADV_DONTNEED), "madvise MADV_DONTNEED");
+  CHECK (get_phys_addr (buf) == 0, "check if page is dropped");
+  CHECK (buf[0] == 0 && buf[PAGE_SIZE] == 0,
+         "check that dropped pages read as zeros");
+
+  /* File pages are read in ahead of use. */
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (actual, 4096, 0, handle, 0)) != MAP_FAILED,
+         "mmap \"sample.txt\"");
+  CHECK (madvise (actual, 4096, MADV_WILLNEED), "madvise MADV_WILLNEED");
+  CHECK (get_phys_addr (actual) != 0, "check if page is loaded");
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+  CHECK (madvise (actual, 4096, MADV_SEQUENTIAL), "madvise MADV_SEQUENTIAL");
+
+  /* Bad arguments. */
+  CHECK (!madvise (buf + 1, PAGE_SIZE, MADV_NORMAL),
+         "madvise of misaligned address must fail");
+  CHECK (!madvise (buf, PAGE_SIZE, 42), "madvise with bad advice must fail");
+  CHECK (!madvise ((char *) 0x20000000, PAGE_SIZE, MADV_NORMAL),
+         "madvise of unmapped range must fail");
+
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise) begin
+(madvise) madvise MADV_DONTNEED
+(madvise) check if page is dropped
+(madvise) check that dropped pages read as zeros
+(madvise) open "sample.txt"
+(madvise) mmap "sample.txt"
+(madvise) madvise MADV_WILLNEED
+(madvise) check if page is loaded
+(madvise) madvise MADV_SEQUENTIAL
+(madvise) madvise of misaligned address must fail
+(madvise) madvise with bad advice must fail
+(madvise) madvise of unmapped range must fail
+(madvise) end
+EOF
+pass;
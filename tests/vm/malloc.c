@@ -0,0 +1,77 @@
+/* Allocates blocks of many sizes with malloc(), small ones carved
+   from the heap and big ones mapped on their own, and checks that
+   they keep their data through frees, reallocation and reuse.  Also
+   checks that calloc() zeroes and refuses sizes that overflow. */
+
+#include <malloc.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_CNT 64
+
+static char *blocks[BLOCK_CNT];
+
+static size_t
+block_size (size_t i)
+{
+  return (i * 97) % 5000 + 1;
+}
+
+static void
+check_block (size_t i)
+{
+  size_t j;
+
+  for (j = 0; j < block_size (i); j++)
+    if (blocks[i][j] != (char) i)
+      fail ("byte %zu of block %zu has value %02hhx (should be %02hhx)",
+            j, i, blocks[i][j], (char) i);
+}
+
+void
+test_main (void)
+{
+  volatile size_t huge = 0x100000001;
+  size_t i;
+  char *p;
+
+  for (i = 0; i < BLOCK_CNT; i++)
+    {
+      blocks[i] = malloc (block_size (i));
+      if (blocks[i] == NULL)
+        fail ("malloc (%zu) failed", block_size (i));
+      memset (blocks[i], (char) i, block_size (i));
+    }
+  msg ("malloc blocks");
+
+  for (i = 0; i < BLOCK_CNT; i += 2)
+    free (blocks[i]);
+  for (i = 0; i < BLOCK_CNT; i += 2)
+    {
+      blocks[i] = malloc (block_size (i));
+      if (blocks[i] == NULL)
+        fail ("malloc (%zu) failed", block_size (i));
+      memset (blocks[i], (char) i, block_size (i));
+    }
+  for (i = 0; i < BLOCK_CNT; i++)
+    check_block (i);
+  msg ("free and reuse blocks");
+
+  p = realloc (blocks[1], 3 * 4096);
+  CHECK (p != NULL && p[0] == 1 && p[block_size (1) - 1] == 1,
+         "realloc keeps the data");
+  free (p);
+
+  p = calloc (2, 4096);
+  CHECK (p != NULL && p[0] == 0 && p[2 * 4096 - 1] == 0, "calloc zeroes");
+  free (p);
+  /* The product wraps to 2^33 + 1, more than either factor. */
+  CHECK (calloc (huge, huge) == NULL,
+         "calloc that overflows must fail");
+
+  for (i = 2; i < BLOCK_CNT; i++)
+    free (blocks[i]);
+  free (blocks[0]);
+}
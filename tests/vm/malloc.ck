@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(malloc) begin
+(malloc) malloc blocks
+(malloc) free and reuse blocks
+(malloc) realloc keeps the data
+(malloc) calloc zeroes
+(malloc) calloc that overflows must fail
+(malloc) end
+EOF
+pass;
@@ -0,0 +1,39 @@
+/* Maps anonymous memory, at an address of the kernel's choosing and
+   at a fixed one, and checks that it is loaded lazily and reads as
+   zeros.  A file mapping without a file must fail. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+void
+test_main (void)
+{
+  char *fixed = (char *) 0x10000000;
+  char *map;
+  size_t i;
+
+  CHECK ((map = mmap (NULL, 3 * PAGE_SIZE, true | MAP_ANONYMOUS, -1, 0))
+         != MAP_FAILED, "mmap anonymous memory");
+  CHECK (get_phys_addr (map) == 0, "check if page is not loaded");
+  for (i = 0; i < 3 * PAGE_SIZE; i++)
+    if (map[i] != 0)
+      fail ("byte %zu of mmap'd region has value %02hhx (should be 0)",
+            i, map[i]);
+  memset (map, 'x', 3 * PAGE_SIZE);
+  CHECK (map[2 * PAGE_SIZE] == 'x', "check memory content");
+  munmap (map);
+
+  CHECK (mmap (fixed, PAGE_SIZE, true | MAP_ANONYMOUS, -1, 0) == fixed,
+         "mmap anonymous memory at a fixed address");
+  fixed[0] = 'y';
+  CHECK (fixed[0] == 'y' && fixed[PAGE_SIZE - 1] == 0,
+         "check memory content");
+  munmap (fixed);
+
+  CHECK (mmap (NULL, PAGE_SIZE, true, -1, 0) == MAP_FAILED,
+         "mmap of no file must fail");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-anon) begin
+(mmap-anon) mmap anonymous memory
+(mmap-anon) check if page is not loaded
+(mmap-anon) check memory content
+(mmap-anon) mmap anonymous memory at a fixed address
+(mmap-anon) check memory content
+(mmap-anon) mmap of no file must fail
+(mmap-anon) end
+EOF
+pass;
@@ -0,0 +1,28 @@
+/* Maps a file with MAP_POPULATE and checks that its page is loaded
+   before the first touch. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  int handle;
+  void *map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (actual, 4096, MAP_POPULATE, handle, 0))
+         != MAP_FAILED, "mmap \"sample.txt\" with MAP_POPULATE");
+  CHECK (get_phys_addr (actual) != 0, "check if page is loaded");
+
+  /* Check that data is correct. */
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+
+  munmap (map);
+  close (handle);
+}
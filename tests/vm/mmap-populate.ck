@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-populate) begin
+(mmap-populate) open "sample.txt"
+(mmap-populate) mmap "sample.txt" with MAP_POPULATE
+(mmap-populate) check if page is loaded
+(mmap-populate) end
+EOF
+pass;
@@ -0,0 +1,48 @@
+/* Writes to a file mapping, flushes it with msync(MS_SYNC), and
+   checks that read() sees the new data while the mapping is still
+   in place.  Also checks that bad arguments are refused. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  static const char overwrite[] = "Synced through msync";
+  char *actual = (char *) 0x10000000;
+  char buf[sizeof sample];
+  int handle, handle2;
+  void *map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (actual, 4096, 1, handle, 0)) != MAP_FAILED,
+         "mmap \"sample.txt\"");
+  memcpy (actual, overwrite, strlen (overwrite));
+  CHECK (msync (actual, 4096, MS_SYNC), "msync MS_SYNC");
+
+  /* Read the file back without the mapping. */
+  memcpy (sample, overwrite, strlen (overwrite));
+  CHECK ((handle2 = open ("sample.txt")) > 1, "open \"sample.txt\" again");
+  CHECK (read (handle2, buf, strlen (sample)) == (int) strlen (sample),
+         "read \"sample.txt\"");
+  CHECK (!memcmp (buf, sample, strlen (sample)),
+         "check that the file has the new data");
+  close (handle2);
+
+  CHECK (msync (actual, 4096, MS_ASYNC), "msync MS_ASYNC");
+
+  /* Bad arguments. */
+  CHECK (!msync (actual + 1, 4096, MS_SYNC),
+         "msync of misaligned address must fail");
+  CHECK (!msync (actual, 4096, 0), "msync without flags must fail");
+  CHECK (!msync (actual, 4096, MS_SYNC | MS_ASYNC),
+         "msync with both flags must fail");
+  CHECK (!msync ((char *) 0x20000000, 4096, MS_SYNC),
+         "msync of unmapped range must fail");
+
+  munmap (map);
+  close (handle);
+}
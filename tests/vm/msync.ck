@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(msync) begin
+(msync) open "sample.txt"
+(msync) mmap "sample.txt"
+(msync) msync MS_SYNC
+(msync) open "sample.txt" again
+(msync) read "sample.txt"
+(msync) check that the file has the new data
+(msync) msync MS_ASYNC
+(msync) msync of misaligned address must fail
+(msync) msync without flags must fail
+(msync) msync with both flags must fail
+(msync) msync of unmapped range must fail
+(msync) end
+EOF
+pass;
@@ -0,0 +1,40 @@
+/* Grows and shrinks the heap with sbrk() and checks that new heap
+   pages are zeroed and writable, that kept pages keep their data,
+   and that the break cannot move below the start of the heap. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+void
+test_main (void)
+{
+  char *base;
+  size_t i;
+
+  base = sbrk (0);
+  CHECK (base != SBRK_FAILED && ((unsigned long) base & (PAGE_SIZE - 1)) == 0,
+         "sbrk (0)");
+  CHECK (sbrk (3 * PAGE_SIZE) == base, "grow the heap by 3 pages");
+  CHECK (sbrk (0) == base + 3 * PAGE_SIZE, "check the new break");
+  for (i = 0; i < 3 * PAGE_SIZE; i++)
+    if (base[i] != 0)
+      fail ("byte %zu of the heap has value %02hhx (should be 0)",
+            i, base[i]);
+  memset (base, 'x', 3 * PAGE_SIZE);
+
+  CHECK (sbrk (-2 * PAGE_SIZE) == base + 3 * PAGE_SIZE,
+         "shrink the heap by 2 pages");
+  CHECK (base[0] == 'x' && base[PAGE_SIZE - 1] == 'x',
+         "check that the first page is kept");
+  CHECK (sbrk (2 * PAGE_SIZE) == base + PAGE_SIZE, "grow the heap again");
+  CHECK (base[PAGE_SIZE] == 0 && base[3 * PAGE_SIZE - 1] == 0,
+         "check that released pages come back zeroed");
+
+  CHECK (sbrk (-4 * PAGE_SIZE) == SBRK_FAILED,
+         "shrinking below the heap start must fail");
+  CHECK (sbrk (0) == base + 3 * PAGE_SIZE, "check that the break is kept");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sbrk) begin
+(sbrk) sbrk (0)
+(sbrk) grow the heap by 3 pages
+(sbrk) check the new break
+(sbrk) shrink the heap by 2 pages
+(sbrk) check that the first page is kept
+(sbrk) grow the heap again
+(sbrk) check that released pages come back zeroed
+(sbrk) shrinking below the heap start must fail
+(sbrk) check that the break is kept
+(sbrk) end
+EOF
+pass;
@@ -0,0 +1,34 @@
+/* Starts child-args with spawn(), which copies nothing of this
+   process, and checks that it gets its arguments.  The child's
+   descriptors are set up by a list of actions; one that fails makes
+   the spawn fail. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char *argv[] = {"child-args", "one", "two", NULL};
+  struct spawn_action actions[] = {
+    {.type = SPAWN_CLOSE, .fd = 0},
+    {.type = SPAWN_OPEN, .fd = 5, .path = "child-args"},
+    {.type = SPAWN_DUP2, .fd = 5, .newfd = 0},
+  };
+  struct spawn_action bad = {.type = SPAWN_DUP2, .fd = 77, .newfd = 3};
+  pid_t child;
+
+  msg ("spawn \"child-args\"");
+  child = spawn ("child-args", argv, actions, 3);
+  if (child == PID_ERROR)
+    fail ("spawn \"child-args\" failed");
+  if (wait (child) != 0)
+    fail ("child-args exited with a wrong exit code");
+  msg ("wait for child");
+
+  CHECK (spawn ("child-args", argv, &bad, 1) == PID_ERROR,
+         "spawn with a bad action must fail");
+  CHECK (spawn ((char *) 0x20101234, argv, NULL, 0) == PID_ERROR,
+         "spawn with a bad path must fail");
+}
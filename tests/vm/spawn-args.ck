@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(spawn-args) begin
+(spawn-args) spawn "child-args"
+(args) begin
+(args) argc = 3
+(args) argv[0] = 'child-args'
+(args) argv[1] = 'one'
+(args) argv[2] = 'two'
+(args) argv[3] = null
+(args) end
+(spawn-args) wait for child
+(spawn-args) spawn with a bad action must fail
+(spawn-args) spawn with a bad path must fail
+(spawn-args) end
+EOF
+pass;
@@ -0,0 +1,40 @@
+/* Lowers the stack limit with stack_limit(), grows the stack within
+   it, and then past it.  The process must be terminated with -1 exit
+   code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char __attribute__ ((noinline))
+use_stack_32k (void)
+{
+  volatile char buf[32 * 1024];
+
+  buf[0] = 1;
+  return buf[0];
+}
+
+static char __attribute__ ((noinline))
+use_stack_128k (void)
+{
+  volatile char buf[128 * 1024];
+
+  buf[0] = 1;
+  return buf[0];
+}
+
+void
+test_main (void)
+{
+  CHECK (stack_limit (64 * 1024), "stack_limit (64 kB)");
+  use_stack_32k ();
+  msg ("used 32 kB of stack");
+
+  CHECK (!stack_limit (4096), "stack_limit below the stack size must fail");
+  CHECK (!stack_limit (16 << 20), "stack_limit of 16 MB must fail");
+
+  msg ("use 128 kB of stack");
+  use_stack_128k ();
+  fail ("grew the stack past its limit");
+}
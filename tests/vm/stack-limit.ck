@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(stack-limit) begin
+(stack-limit) stack_limit (64 kB)
+(stack-limit) used 32 kB of stack
+(stack-limit) stack_limit below the stack size must fail
+(stack-limit) stack_limit of 16 MB must fail
+(stack-limit) use 128 kB of stack
+stack-limit: exit(-1)
+EOF
+pass;
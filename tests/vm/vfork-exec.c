@@ -0,0 +1,29 @@
+/* Runs a vfork() child that writes to memory of this process, which
+   it borrows, and then execs child-args.  The write must be seen
+   here, and this process must wait until the exec. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static volatile int shared;
+
+void
+test_main (void)
+{
+  pid_t child;
+  int status;
+
+  msg ("vfork");
+  child = vfork ();
+  if (child == 0) {
+    shared = 42;
+    exec ("child-args childarg");
+    exit (-1);
+  }
+  /* The child runs on from its exec while we do; let it finish. */
+  status = wait (child);
+  CHECK (child != PID_ERROR, "vfork returned a pid");
+  CHECK (shared == 42, "check that the child wrote to our memory");
+  CHECK (status == 0, "wait for child");
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(vfork-exec) begin
+(vfork-exec) vfork
+(args) begin
+(args) argc = 2
+(args) argv[0] = 'child-args'
+(args) argv[1] = 'childarg'
+(args) argv[2] = null
+(args) end
+(vfork-exec) vfork returned a pid
+(vfork-exec) check that the child wrote to our memory
+(vfork-exec) wait for child
+(vfork-exec) end
+EOF
+pass;
@@ -21,8 +21,10 @@
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
+#include "userprog/exec_cache.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
@@ -31,6 +33,8 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/zswap.h"
+#include "vm/ksm.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -41,6 +45,9 @@
 /* Page-map-level-4 with kernel mappings only. */
 uint64_t *base_pml4;
 
+/* Amount of physical memory, in 4 kB pages. */
+size_t ram_pages;
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -84,6 +91,7 @@ main (void) {
 
 	/* Initialize memory system. */
 	mem_end = palloc_init ();
+	ram_pages = mem_end / PGSIZE;
 	malloc_init ();
 	paging_init (mem_end);
 
@@ -100,6 +108,7 @@ main (void) {
 #ifdef USERPROG
 	exception_init ();
 	syscall_init ();
+	exec_cache_init ();
 #endif
 	/* Start thread scheduler and enable interrupts. */
 	thread_start ();
@@ -140,31 +149,72 @@ bss_init (void) {
 	memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Returns true if the CPU can map 1 GiB pages in a PDPE. */
+static bool
+cpu_has_huge_pages (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid (0x80000000, 0, &eax, &ebx, &ecx, &edx);
+	if (eax < 0x80000001)
+		return false;
+	cpuid (0x80000001, 0, &eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 26)) != 0;
+}
+
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ *
+ * Physical memory is mapped with the largest page that fits:
+ * 1 GiB pages if the CPU supports them, then 2 MiB pages.  Only
+ * the 2 MiB blocks that overlap the kernel text, which must be
+ * read-only, and the unaligned tail are mapped 4 kB at a time. */
 static void
 paging_init (uint64_t mem_end) {
 	uint64_t *pml4, *pte;
 	int perm;
+	bool huge_pages = cpu_has_huge_pages ();
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+	uint64_t text_start = (uint64_t) &start;
+	uint64_t text_end = (uint64_t) &_end_kernel_text;
+
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	for (uint64_t pa = 0; pa < mem_end; ) {
 		uint64_t va = (uint64_t) ptov(pa);
+		uint64_t size;
+
+		/* Try a large page first.  Both VA and PA must be aligned to
+		 * its size and it must not cover any kernel text. */
+		for (size = huge_pages ? HUGE_PGSIZE : LARGE_PGSIZE;
+				size >= LARGE_PGSIZE; size >>= (PDPESHIFT - PDXSHIFT)) {
+			if (va % size == 0 && pa + size <= mem_end
+					&& (va + size <= text_start || text_end <= va)) {
+				if ((pte = pml4e_walk_large (pml4, va, size, 1)) == NULL)
+					PANIC ("paging_init: out of page table memory");
+				*pte = pa | PTE_P | PTE_W | PTE_PS;
+				break;
+			}
+		}
+		if (size >= LARGE_PGSIZE) {
+			pa += size;
+			continue;
+		}
 
 		perm = PTE_P | PTE_W;
-		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
+		if (text_start <= va && va < text_end)
 			perm &= ~PTE_W;
 
 		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
 			*pte = pa | perm;
+		pa += PGSIZE;
 	}
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_init_pcid ();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -226,6 +276,14 @@ parse_options (char **argv) {
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-zswap"))
+			zswap_max_percent = atoi (value);
+		else if (!strcmp (name, "-ksm"))
+			ksm_pages_to_scan = atoi (value);
+		else if (!strcmp (name, "-stack-chunk"))
+			stack_chunk_pages = atoi (value);
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -328,6 +386,12 @@ usage (void) {
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -zswap=PERCENT     Let compressed swap use PERCENT of RAM, at most\n"
+			"                     half of the kernel pool.\n"
+			"  -ksm=PAGES         Merge-scan PAGES frames per 20 ms (default: 0, off).\n"
+			"  -stack-chunk=PAGES Grow user stacks PAGES pages at a time.\n"
 #endif
 			);
 	power_off ();
@@ -354,6 +418,7 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	palloc_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -361,5 +426,9 @@ print_stats (void) {
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
+	exec_cache_print_stats ();
+#endif
+#ifdef VM
+	vm_print_stats ();
 #endif
 }
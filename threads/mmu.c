@@ -6,10 +6,35 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
+#include "threads/interrupt.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers (PCIDs).
+ *
+ * When the CPU supports them, each user pml4 gets a 12-bit tag from a
+ * small pool.  TLB entries are tagged with the PCID that was in CR3
+ * when they were filled, so CR3 can be reloaded with CR3_NOFLUSH and
+ * a process that is switched back in still finds its translations.
+ * PCID 0 belongs to base_pml4.  Tags are handed out round-robin; a
+ * pml4 that loses its tag is simply given a new one on its next
+ * activation, and a tag's first load after reassignment is done
+ * without CR3_NOFLUSH so the previous owner's entries are dropped. */
+#define PCID_CNT 64                     /* Size of the PCID pool. */
+#define CR3_NOFLUSH (1UL << 63)         /* Keep TLB entries on CR3 load. */
+#define CR4_PCIDE (1UL << 17)           /* CR4 PCID enable bit. */
+
+static bool pcid_enabled;               /* CR4.PCIDE is set. */
+static bool invpcid_enabled;            /* INVPCID is supported. */
+static uint64_t *pcid_owner[PCID_CNT];  /* pml4 holding each PCID. */
+static unsigned pcid_next = 1;          /* Next PCID to hand out. */
+
+static void pcid_release (uint64_t *pml4);
+static bool pml4_is_active (uint64_t *pml4);
+static void tlb_invalidate (uint64_t *pml4, const void *va);
+static void tlb_flush_all (uint64_t *pml4);
+
 static uint64_t *
-pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
+pgdir_walk (uint64_t *pdp, const uint64_t va, int create, uint64_t *size) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
@@ -23,13 +48,19 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		if (pdp[idx] & PTE_PS) {
+			/* 2 MiB leaf. */
+			*size = LARGE_PGSIZE;
+			return &pdp[idx];
+		}
+		*size = PGSIZE;
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
 	return NULL;
 }
 
 static uint64_t *
-pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
+pdpe_walk (uint64_t *pdpe, const uint64_t va, int create, uint64_t *size) {
 	uint64_t *pte = NULL;
 	int idx = PDPE (va);
 	int allocated = 0;
@@ -46,7 +77,12 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
-		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
+		if (pdpe[idx] & PTE_PS) {
+			/* 1 GiB leaf. */
+			*size = HUGE_PGSIZE;
+			return &pdpe[idx];
+		}
+		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create, size);
 	}
 	if (pte == NULL && allocated) {
 		palloc_free_page ((void *) ptov (PTE_ADDR (pdpe[idx])));
@@ -55,14 +91,11 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 	return pte;
 }
 
-/* Returns the address of the page table entry for virtual
- * address VADDR in page map level 4, pml4.
- * If PML4E does not have a page table for VADDR, behavior depends
- * on CREATE.  If CREATE is true, then a new page table is
- * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
-uint64_t *
-pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
+/* Walks PML4E down to the leaf entry that maps VA and stores the
+ * number of bytes that leaf maps into *SIZE. */
+static uint64_t *
+pml4e_walk_leaf (uint64_t *pml4e, const uint64_t va, int create,
+		uint64_t *size) {
 	uint64_t *pte = NULL;
 	int idx = PML4 (va);
 	int allocated = 0;
@@ -79,7 +112,7 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
-		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create);
+		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create, size);
 	}
 	if (pte == NULL && allocated) {
 		palloc_free_page ((void *) ptov (PTE_ADDR (pml4e[idx])));
@@ -88,6 +121,54 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page table entry for virtual
+ * address VADDR in page map level 4, pml4.
+ * If PML4E does not have a page table for VADDR, behavior depends
+ * on CREATE.  If CREATE is true, then a new page table is
+ * created and a pointer into it is returned.  Otherwise, a null
+ * pointer is returned.
+ * If VADDR is covered by a 2 MiB or 1 GiB mapping, the returned
+ * pointer is that large-page PDE or PDPE, which has PTE_PS set. */
+uint64_t *
+pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
+	uint64_t size;
+	return pml4e_walk_leaf (pml4e, va, create, &size);
+}
+
+/* Returns the address of the entry that maps the SIZE-byte large
+ * page at VA, where SIZE is LARGE_PGSIZE (a PDE) or HUGE_PGSIZE (a
+ * PDPE), creating the upper levels if CREATE is true.  The caller
+ * fills the entry in with PTE_PS set.  Returns a null pointer if
+ * memory allocation fails or if VA is already covered by a larger
+ * leaf. */
+uint64_t *
+pml4e_walk_large (uint64_t *pml4, const uint64_t va, uint64_t size,
+		int create) {
+	ASSERT (size == LARGE_PGSIZE || size == HUGE_PGSIZE);
+	ASSERT (va % size == 0);
+
+	uint64_t *pdpe = pml4 + PML4 (va);
+	if (!(*pdpe & PTE_P)) {
+		uint64_t *new_page;
+		if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+			return NULL;
+		*pdpe = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	uint64_t *pde = (uint64_t *) ptov (PTE_ADDR (*pdpe)) + PDPE (va);
+	if (size == HUGE_PGSIZE)
+		return pde;
+
+	if (*pde & PTE_PS)
+		return NULL;
+	if (!(*pde & PTE_P)) {
+		uint64_t *new_page;
+		if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+			return NULL;
+		*pde = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	return (uint64_t *) ptov (PTE_ADDR (*pde)) + PDX (va);
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,10 +203,18 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS) {
+				/* 2 MiB leaf: hand the PDE itself to FUNC. */
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) pdp_index << PDPESHIFT) |
+									 ((uint64_t) i << PDXSHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -135,10 +224,17 @@ pdp_for_each (uint64_t *pdp,
 		pte_for_each_func *func, void *aux, unsigned pml4_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pde) & PTE_P)
-			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
+		if (((uint64_t) pde) & PTE_P) {
+			if (pdp[i] & PTE_PS) {
+				/* 1 GiB leaf: hand the PDPE itself to FUNC. */
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) i << PDPESHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
 					 aux, pml4_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -155,6 +251,224 @@ pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	return true;
 }
 
+/* Returns the table that ENTRY points to, allocating an empty one if
+ * ENTRY is not present and CREATE is true.  Returns a null pointer if
+ * there is no table. */
+static uint64_t *
+next_level (uint64_t *entry, bool create) {
+	if (!(*entry & PTE_P)) {
+		uint64_t *new_page;
+		if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+			return NULL;
+		*entry = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	return ptov (PTE_ADDR (*entry));
+}
+
+/* Returns the first address past the region that VA's entry at the
+ * level indexed by bit SHIFT covers. */
+static uint64_t
+level_end (uint64_t va, unsigned shift) {
+	return (va | ((1UL << shift) - 1)) + 1;
+}
+
+/* Applies FUNC to the leaf entries mapping [START, END).  Unlike
+ * pml4_for_each(), each table is reached once per range instead of
+ * once per page, and subtrees without a present entry are skipped
+ * whole.  If CREATE is true, missing tables are allocated and FUNC is
+ * called for every 4 kB entry in the range, present or not; otherwise
+ * only present entries are visited.  Large-page leaves (PTE_PS) are
+ * passed to FUNC as they are.  Returns false if FUNC returns false or
+ * a table cannot be allocated. */
+bool
+pml4_walk_range (uint64_t *pml4, void *start_, void *end_, bool create,
+		pte_for_each_func *func, void *aux) {
+	uint64_t va = (uint64_t) start_;
+	uint64_t end = (uint64_t) end_;
+
+	ASSERT (pg_ofs (va) == 0);
+	while (va < end) {
+		uint64_t *pdpt = next_level (&pml4[PML4 (va)], create);
+		if (pdpt == NULL) {
+			if (create)
+				return false;
+			va = level_end (va, PML4SHIFT);
+			continue;
+		}
+
+		uint64_t *pdpe = &pdpt[PDPE (va)];
+		if ((*pdpe & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+			if (!func (pdpe, (void *) va, aux))
+				return false;
+			va = level_end (va, PDPESHIFT);
+			continue;
+		}
+		uint64_t *pd = next_level (pdpe, create);
+		if (pd == NULL) {
+			if (create)
+				return false;
+			va = level_end (va, PDPESHIFT);
+			continue;
+		}
+
+		uint64_t *pde = &pd[PDX (va)];
+		if ((*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+			if (!func (pde, (void *) va, aux))
+				return false;
+			va = level_end (va, PDXSHIFT);
+			continue;
+		}
+		uint64_t *pt = next_level (pde, create);
+		if (pt == NULL) {
+			if (create)
+				return false;
+			va = level_end (va, PDXSHIFT);
+			continue;
+		}
+
+		uint64_t limit = level_end (va, PDXSHIFT);
+		if (limit > end)
+			limit = end;
+		for (; va < limit; va += PGSIZE) {
+			uint64_t *pte = &pt[PTX (va)];
+			if ((create || (*pte & PTE_P)) && !func (pte, (void *) va, aux))
+				return false;
+		}
+	}
+	return true;
+}
+
+/* Beyond this many pages, a range operation flushes the whole
+ * address space instead of issuing one invlpg per page. */
+#define TLB_BATCH_MAX 32
+
+/* TLB invalidations collected while walking a range. */
+struct tlb_batch {
+	uint64_t *pml4;
+	size_t cnt;                      /* Pages that need invalidation. */
+	void *va[TLB_BATCH_MAX];         /* First TLB_BATCH_MAX of them. */
+};
+
+static void
+tlb_batch_add (struct tlb_batch *batch, void *va) {
+	if (batch->cnt < TLB_BATCH_MAX)
+		batch->va[batch->cnt] = va;
+	batch->cnt++;
+}
+
+/* Issues the invalidations collected in BATCH. */
+static void
+tlb_batch_flush (struct tlb_batch *batch) {
+	if (batch->cnt > TLB_BATCH_MAX)
+		tlb_flush_all (batch->pml4);
+	else
+		for (size_t i = 0; i < batch->cnt; i++)
+			tlb_invalidate (batch->pml4, batch->va[i]);
+	batch->cnt = 0;
+}
+
+/* State for pml4_map_range(). */
+struct map_range {
+	uint8_t *start;
+	void **kpages;
+	uint64_t perm;
+};
+
+static bool
+map_range_pte (uint64_t *pte, void *va, void *aux) {
+	struct map_range *m = aux;
+	void *kpage = m->kpages[((uint8_t *) va - m->start) / PGSIZE];
+
+	if (kpage == NULL)
+		return true;
+	/* Like pml4_set_page(), the range must not be mapped yet. */
+	if (*pte & PTE_P)
+		return false;
+	*pte = vtop (kpage) | m->perm;
+	return true;
+}
+
+/* Maps each user page in [START, END) of PML4 to the frame at the
+ * kernel virtual address in KPAGES with the same index, skipping the
+ * pages whose entry is a null pointer.  The pages are read/write if
+ * WRITABLE is true, read-only otherwise.  Missing tables are allocated
+ * as the range is walked, so a run of pages costs one descent from the
+ * root per page table instead of one per page.  Returns false if a page
+ * in the range is already mapped or a table cannot be allocated; the
+ * pages before it may have been mapped by then. */
+bool
+pml4_map_range (uint64_t *pml4, void *start, void *end, void **kpages,
+		bool writable) {
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT (is_user_vaddr (start) && (start == end || is_user_vaddr (end - 1)));
+	ASSERT (pml4 != base_pml4);
+
+	struct map_range m = {
+		.start = start,
+		.kpages = kpages,
+		.perm = PTE_P | PTE_U | (writable ? PTE_W : 0),
+	};
+	return pml4_walk_range (pml4, start, end, true, map_range_pte, &m);
+}
+
+static bool
+unmap_range_pte (uint64_t *pte, void *va, void *aux) {
+	struct tlb_batch *tlb = aux;
+
+	/* A 2 MiB leaf is left to its owner, which splits it first. */
+	if (*pte & PTE_PS)
+		return true;
+	*pte &= ~PTE_P;
+	tlb_batch_add (tlb, va);
+	return true;
+}
+
+/* Marks every user page in [START, END) of PML4 "not present", like
+ * pml4_clear_page() over the range, except for pages mapped by a 2 MiB
+ * entry.  Empty parts of the range cost nothing, and the TLB is
+ * invalidated once at the end. */
+void
+pml4_unmap_range (uint64_t *pml4, void *start, void *end) {
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT (is_user_vaddr (start) && (start == end || is_user_vaddr (end - 1)));
+
+	struct tlb_batch tlb = { .pml4 = pml4 };
+	pml4_walk_range (pml4, start, end, false, unmap_range_pte, &tlb);
+	tlb_batch_flush (&tlb);
+}
+
+/* State for pml4_protect_range(). */
+struct protect_range {
+	struct tlb_batch tlb;
+	bool writable;
+};
+
+static bool
+protect_range_pte (uint64_t *pte, void *va, void *aux) {
+	struct protect_range *p = aux;
+	uint64_t old = *pte;
+
+	if (p->writable)
+		*pte |= PTE_W;
+	else
+		*pte &= ~PTE_W;
+	if (*pte != old)
+		tlb_batch_add (&p->tlb, va);
+	return true;
+}
+
+/* Makes every mapped user page in [START, END) of PML4 read/write if
+ * WRITABLE is true, read-only otherwise. */
+void
+pml4_protect_range (uint64_t *pml4, void *start, void *end, bool writable) {
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT (is_user_vaddr (start) && (start == end || is_user_vaddr (end - 1)));
+
+	struct protect_range p = { .tlb = { .pml4 = pml4 }, .writable = writable };
+	pml4_walk_range (pml4, start, end, false, protect_range_pte, &p);
+	tlb_batch_flush (&p.tlb);
+}
+
 static void
 pt_destroy (uint64_t *pt) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
@@ -169,7 +483,8 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		/* The frames of a 2 MiB leaf belong to its owner. */
+		if ((((uint64_t) pte) & PTE_P) && !(pdp[i] & PTE_PS))
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -192,6 +507,12 @@ pml4_destroy (uint64_t *pml4) {
 		return;
 	ASSERT (pml4 != base_pml4);
 
+	/* A kernel thread may still be running on PML4 (see
+	 * process_activate()), so move off it before freeing it. */
+	if (pml4_is_active (pml4))
+		pml4_activate (NULL);
+	pcid_release (pml4);
+
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
@@ -199,11 +520,117 @@ pml4_destroy (uint64_t *pml4) {
 	palloc_free_page ((void *) pml4);
 }
 
+/* Enables PCID-tagged TLB entries if the CPU supports them.
+ * Must be called while base_pml4 is active with PCID 0. */
+void
+pml4_init_pcid (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid (1, 0, &eax, &ebx, &ecx, &edx);
+	if (!(ecx & (1 << 17)))
+		return;
+	cpuid (0, 0, &eax, &ebx, &ecx, &edx);
+	if (eax >= 7) {
+		cpuid (7, 0, &eax, &ebx, &ecx, &edx);
+		invpcid_enabled = (ebx & (1 << 10)) != 0;
+	}
+
+	ASSERT ((rcr3 () & PGMASK) == 0);
+	lcr4 (rcr4 () | CR4_PCIDE);
+	pcid_enabled = true;
+}
+
+/* Returns the PCID currently held by PML4, or 0 if it has none. */
+static unsigned
+pcid_lookup (uint64_t *pml4) {
+	for (unsigned pcid = 1; pcid < PCID_CNT; pcid++)
+		if (pcid_owner[pcid] == pml4)
+			return pcid;
+	return 0;
+}
+
+/* Gives PML4's PCID, if any, back to the pool. */
+static void
+pcid_release (uint64_t *pml4) {
+	enum intr_level old_level = intr_disable ();
+	unsigned pcid = pcid_lookup (pml4);
+	if (pcid != 0)
+		pcid_owner[pcid] = NULL;
+	intr_set_level (old_level);
+}
+
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  Does nothing if PD is already loaded.  With PCIDs, the
+ * switch keeps the TLB entries of every address space that still
+ * holds its PCID. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	if (pml4_is_active (pml4 ? pml4 : base_pml4))
+		return;
+	if (!pcid_enabled || pml4 == NULL) {
+		lcr3 (vtop (pml4 ? pml4 : base_pml4) | (pcid_enabled ? CR3_NOFLUSH : 0));
+		return;
+	}
+
+	enum intr_level old_level = intr_disable ();
+	unsigned pcid = pcid_lookup (pml4);
+	if (pcid != 0)
+		lcr3 (vtop (pml4) | pcid | CR3_NOFLUSH);
+	else {
+		/* Take the next PCID from its current owner.  Loading it
+		 * without CR3_NOFLUSH drops whatever that owner left behind. */
+		pcid = pcid_next;
+		pcid_next = pcid_next + 1 < PCID_CNT ? pcid_next + 1 : 1;
+		pcid_owner[pcid] = pml4;
+		lcr3 (vtop (pml4) | pcid);
+	}
+	intr_set_level (old_level);
+}
+
+/* Returns true if PML4 is the page table the CPU is using now. */
+static bool
+pml4_is_active (uint64_t *pml4) {
+	return PTE_ADDR (rcr3 ()) == vtop (pml4);
+}
+
+/* Drops any TLB entry for VA in PML4.  The active address space is
+ * handled with invlpg.  An inactive one may still have entries
+ * tagged with its PCID, which are removed with INVPCID, or, on CPUs
+ * without it, by taking the PCID away so the next activation starts
+ * with a flushed tag. */
+static void
+tlb_invalidate (uint64_t *pml4, const void *va) {
+	if (pml4_is_active (pml4))
+		invlpg ((uint64_t) va);
+	else if (pcid_enabled) {
+		unsigned pcid = pcid_lookup (pml4);
+		if (pcid == 0)
+			return;
+		if (invpcid_enabled)
+			invpcid (INVPCID_ADDR, pcid, (uint64_t) va);
+		else
+			pcid_release (pml4);
+	}
+}
+
+/* Drops every non-global TLB entry that belongs to PML4. */
+static void
+tlb_flush_all (uint64_t *pml4) {
+	if (!pcid_enabled) {
+		if (pml4_is_active (pml4))
+			lcr3 (rcr3 ());
+		return;
+	}
+
+	unsigned pcid = pcid_lookup (pml4);
+	if (pml4_is_active (pml4))
+		lcr3 (vtop (pml4) | pcid);
+	else if (pcid != 0) {
+		if (invpcid_enabled)
+			invpcid (INVPCID_CONTEXT, pcid, 0);
+		else
+			pcid_release (pml4);
+	}
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -214,10 +641,12 @@ void *
 pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	ASSERT (is_user_vaddr (uaddr));
 
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
+	uint64_t size;
+	uint64_t *pte = pml4e_walk_leaf (pml4, (uint64_t) uaddr, 0, &size);
 
 	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+		return ptov (PTE_ADDR (*pte) & ~(size - 1))
+			+ ((uint64_t) uaddr & (size - 1));
 	return NULL;
 }
 
@@ -257,9 +686,62 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_invalidate (pml4, upage);
+	}
+}
+
+/* Maps the LARGE_PGSIZE bytes at user address UPAGE in PML4 to the
+ * physically contiguous frames at KPAGE with a single PDE, read/write
+ * if WRITABLE is true.  Both addresses must be LARGE_PGSIZE aligned.
+ * A page table left at UPAGE with no entry present is unlinked and
+ * stored into *PT, for the caller to keep or free; otherwise *PT is
+ * set to a null pointer.  Returns false if a page in the range is
+ * mapped or memory allocation fails. */
+bool
+pml4_map_large (uint64_t *pml4, void *upage, void *kpage, bool writable,
+		void **pt) {
+	ASSERT ((uint64_t) upage % LARGE_PGSIZE == 0);
+	ASSERT (vtop (kpage) % LARGE_PGSIZE == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pml4e_walk_large (pml4, (uint64_t) upage, LARGE_PGSIZE,
+			true);
+	*pt = NULL;
+	if (pde == NULL || (*pde & PTE_PS))
+		return false;
+	if (*pde & PTE_P) {
+		uint64_t *table = ptov (PTE_ADDR (*pde));
+		for (unsigned i = 0; i < PGSIZE / sizeof *table; i++)
+			if (table[i] & PTE_P)
+				return false;
+		*pt = table;
 	}
+	*pde = vtop (kpage) | PTE_P | PTE_U | PTE_PS | (writable ? PTE_W : 0);
+	/* The old entry may linger in the paging-structure caches. */
+	if (*pt != NULL)
+		tlb_invalidate (pml4, upage);
+	return true;
+}
+
+/* Replaces the 2 MiB mapping at UPAGE in PML4 by PT, a page from the
+ * kernel pool, filled with one entry per 4 kB page that maps the same
+ * frame as before with the permissions, accessed and dirty bits of
+ * the large mapping. */
+void
+pml4_split_large (uint64_t *pml4, void *upage, void *pt_) {
+	uint64_t *pde = pml4e_walk (pml4, (uint64_t) upage, false);
+	uint64_t *pt = pt_;
+
+	ASSERT ((uint64_t) upage % LARGE_PGSIZE == 0);
+	ASSERT (pde != NULL && (*pde & PTE_PS));
+
+	uint64_t flags = *pde & (PTE_P | PTE_W | PTE_U | PTE_A | PTE_D);
+	uint64_t pa = PTE_ADDR (*pde) & ~(LARGE_PGSIZE - 1);
+	for (unsigned i = 0; i < PGSIZE / sizeof *pt; i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	tlb_invalidate (pml4, upage);
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
@@ -283,8 +765,7 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_invalidate (pml4, vpage);
 	}
 }
 
@@ -309,7 +790,6 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_invalidate (pml4, vpage);
 	}
 }
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -24,13 +25,33 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool also keeps a small cache of pages that the idle
+   thread has already zeroed (see palloc_zero_idle()).  Those
+   pages are marked used in the bitmap while they sit in the
+   cache.  Single-page PAL_ZERO requests take from the cache
+   first, so the memset no longer happens on the allocation path.
+   The cache is given back to the bitmap when the pool would
+   otherwise run out. */
+
+/* Maximum number of pre-zeroed pages cached per pool. */
+#define ZERO_CACHE_PAGES 64
 
 /* A memory pool. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+
+	/* Pre-zeroed pages.  Protected by disabling interrupts, since
+	   the idle thread fills it and must never sleep on a lock. */
+	void *zeroed[ZERO_CACHE_PAGES];
+	size_t zeroed_cnt;
+
+	/* Free pages, including the pre-zeroed ones.  Updated with
+	   interrupts off, since pages are freed without the lock. */
+	size_t free_cnt;
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,6 +63,14 @@ static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void pool_take (struct pool *, size_t page_cnt);
+static void *zero_cache_pop (struct pool *);
+static bool zero_cache_drain (struct pool *);
+static void zero_page_nt (void *page);
+
+/* Statistics. */
+static long long zero_cache_hits;   /* PAL_ZERO served from the cache. */
+static long long zero_cache_fills;  /* Pages zeroed by the idle thread. */
 
 /* multiboot info */
 struct multiboot_info {
@@ -250,6 +279,10 @@ palloc_init (void) {
 	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
 		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
 	populate_pools (&base_mem, &ext_mem);
+	kernel_pool.free_cnt = bitmap_count (kernel_pool.used_map, 0,
+			bitmap_size (kernel_pool.used_map), false);
+	user_pool.free_cnt = bitmap_count (user_pool.used_map, 0,
+			bitmap_size (user_pool.used_map), false);
 	return ext_mem.end;
 }
 
@@ -262,15 +295,28 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
 	void *pages;
 
-	if (page_idx != BITMAP_ERROR)
+	if (page_cnt == 1 && (flags & PAL_ZERO)) {
+		pages = zero_cache_pop (pool);
+		if (pages != NULL) {
+			pool_take (pool, 1);
+			zero_cache_hits++;
+			return pages;
+		}
+	}
+
+	size_t page_idx;
+	do {
+		lock_acquire (&pool->lock);
+		page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+		lock_release (&pool->lock);
+	} while (page_idx == BITMAP_ERROR && zero_cache_drain (pool));
+
+	if (page_idx != BITMAP_ERROR) {
 		pages = pool->base + PGSIZE * page_idx;
-	else
+		pool_take (pool, page_cnt);
+	} else
 		pages = NULL;
 
 	if (pages) {
@@ -284,6 +330,40 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Like palloc_get_multiple(), but the pages start at a multiple of
+   ALIGN_CNT pages, a power of 2, in kernel virtual and so in
+   physical memory.  Only aligned runs are looked at, so this is
+   about as fast as an unaligned search.  Pre-zeroed pages are left
+   in their cache, as a large run is not worth draining it for. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt,
+		size_t align_cnt) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t base_no = pg_no (pool->base);
+	size_t page_idx = ROUND_UP (base_no, align_cnt) - base_no;
+	void *pages = NULL;
+
+	ASSERT (align_cnt > 0 && (align_cnt & (align_cnt - 1)) == 0);
+
+	lock_acquire (&pool->lock);
+	for (; page_idx + page_cnt <= bitmap_size (pool->used_map);
+			page_idx += align_cnt)
+		if (bitmap_none (pool->used_map, page_idx, page_cnt)) {
+			bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+			pages = pool->base + PGSIZE * page_idx;
+			break;
+		}
+	lock_release (&pool->lock);
+
+	if (pages != NULL) {
+		pool_take (pool, page_cnt);
+		if (flags & PAL_ZERO)
+			memset (pages, 0, PGSIZE * page_cnt);
+	} else if (flags & PAL_ASSERT)
+		PANIC ("palloc_get: out of pages");
+	return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -319,7 +399,10 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+	enum intr_level old_level = intr_disable ();
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	pool->free_cnt += page_cnt;
+	intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +411,128 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool.  Pages
+   sitting in the pre-zeroed cache count as free: FREE_CNT is not
+   touched when the idle thread caches a page, only when a page
+   leaves the pool through palloc_get_multiple(). */
+size_t
+palloc_user_free (void) {
+	return user_pool.free_cnt;
+}
+
+/* Returns the number of pages in the kernel pool. */
+size_t
+palloc_kernel_size (void) {
+	return bitmap_size (kernel_pool.used_map);
+}
+
+/* Returns the number of free pages in the kernel pool. */
+size_t
+palloc_kernel_free (void) {
+	return kernel_pool.free_cnt;
+}
+
+/* Zeroes one free page and puts it into a pre-zeroed cache.
+   Called by the idle thread with interrupts on.  Returns true if
+   a page was zeroed, false if both caches are full or the pools
+   have no free page left. */
+bool
+palloc_zero_idle (void) {
+	struct pool *pools[] = { &user_pool, &kernel_pool };
+
+	for (size_t i = 0; i < sizeof pools / sizeof *pools; i++) {
+		struct pool *pool = pools[i];
+		size_t page_idx = BITMAP_ERROR;
+
+		/* We must not sleep in the idle thread, so claim the page
+		   with interrupts off, and only if nobody is in the middle
+		   of updating the bitmap. */
+		enum intr_level old_level = intr_disable ();
+		if (pool->zeroed_cnt < ZERO_CACHE_PAGES && pool->lock.holder == NULL)
+			page_idx = bitmap_scan_and_flip (pool->used_map, 0, 1, false);
+		intr_set_level (old_level);
+		if (page_idx == BITMAP_ERROR)
+			continue;
+
+		void *page = pool->base + PGSIZE * page_idx;
+		zero_page_nt (page);
+
+		old_level = intr_disable ();
+		if (pool->zeroed_cnt < ZERO_CACHE_PAGES) {
+			pool->zeroed[pool->zeroed_cnt++] = page;
+			page = NULL;
+		}
+		if (page != NULL)
+			bitmap_reset (pool->used_map, page_idx);
+		intr_set_level (old_level);
+		zero_cache_fills++;
+		return true;
+	}
+	return false;
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	printf ("Palloc: %lld pages pre-zeroed, %lld zeroed allocations "
+			"served from cache\n", zero_cache_fills, zero_cache_hits);
+}
+
+/* Accounts for PAGE_CNT pages just allocated from POOL. */
+static void
+pool_take (struct pool *pool, size_t page_cnt) {
+	enum intr_level old_level = intr_disable ();
+	pool->free_cnt -= page_cnt;
+	intr_set_level (old_level);
+}
+
+/* Takes a pre-zeroed page from POOL's cache.  Returns a null
+   pointer if the cache is empty. */
+static void *
+zero_cache_pop (struct pool *pool) {
+	void *page = NULL;
+
+	enum intr_level old_level = intr_disable ();
+	if (pool->zeroed_cnt > 0)
+		page = pool->zeroed[--pool->zeroed_cnt];
+	intr_set_level (old_level);
+	return page;
+}
+
+/* Returns every cached pre-zeroed page of POOL to its bitmap, so
+   that callers short on memory can use them.  Returns true if
+   any page was released. */
+static bool
+zero_cache_drain (struct pool *pool) {
+	bool released = false;
+	void *page;
+
+	lock_acquire (&pool->lock);
+	while ((page = zero_cache_pop (pool)) != NULL) {
+		bitmap_reset (pool->used_map, pg_no (page) - pg_no (pool->base));
+		released = true;
+	}
+	lock_release (&pool->lock);
+	return released;
+}
+
+/* Fills PAGE with zeros using non-temporal stores, so that
+   zeroing in the background does not evict useful lines from the
+   cache.  MOVNTI only uses general purpose registers, so it is
+   safe even though the kernel never saves the FPU/SSE state. */
+static void
+zero_page_nt (void *page) {
+	uint64_t *p = page;
+
+	for (size_t i = 0; i < PGSIZE / sizeof *p; i += 4)
+		__asm __volatile ("movnti %1, 0(%0)\n"
+				"movnti %1, 8(%0)\n"
+				"movnti %1, 16(%0)\n"
+				"movnti %1, 24(%0)\n"
+				: : "r" (p + i), "r" (0UL) : "memory");
+	__asm __volatile ("sfence" : : : "memory");
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
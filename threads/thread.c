@@ -13,7 +13,6 @@
 #include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
-#include "thread.h"
 #endif
 
 /* Random value for struct thread's `magic' member.
@@ -298,6 +297,21 @@ thread_current (void) {
 	return t;
 }
 
+/* Invokes function 'func' on all threads, passing along 'aux'.
+   This function must be called with interrupts off. */
+void
+thread_foreach (thread_action_func *func, void *aux) {
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (e = list_begin (&all_thread_list); e != list_end (&all_thread_list);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, thread_elem);
+		func (t, aux);
+	}
+}
+
 /* Returns the running thread's tid. */
 tid_t
 thread_tid (void) {
@@ -509,6 +523,16 @@ idle (void *idle_started_ UNUSED) {
 		intr_disable ();
 		thread_block ();
 
+		/* Spend the idle time zeroing free pages ahead of PAL_ZERO
+		   allocations, but stop as soon as another thread is ready
+		   to run. */
+		intr_enable ();
+		while (list_empty (&ready_list) && palloc_zero_idle ())
+			continue;
+		intr_disable ();
+		if (!list_empty (&ready_list))
+			continue;
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -553,6 +577,14 @@ init_thread (struct thread *t, const char *name, int priority) {
 	list_init (&t->locks);
 	t->nice = 0;
 	t->recent_cpu = 0;
+#ifdef USERPROG
+	sema_init (&t->vfork_sema, 0);
+	list_init (&t->children);
+	t->exit_status = -1;
+#endif
+#ifdef VM
+	t->rss_soft = t->rss_hard = SIZE_MAX;
+#endif
 	t->magic = THREAD_MAGIC;
 }
 
@@ -0,0 +1,183 @@
+/* exec_cache.c: Cache of parsed executables.
+ *
+ * Loading a program reads its ELF header and every program header,
+ * and validates each segment, before it builds the address space.
+ * The result, a short list of segments with the entry point, depends
+ * only on the file, so it is kept here, keyed by inode number, for the
+ * EXEC_CACHE_SIZE executables run most recently.  Running one of them
+ * again only maps its segments; their text is shared through the page
+ * cache anyway.
+ *
+ * An entry goes away when its file is written or deleted.  Only inodes
+ * marked by inode_mark_exec_cached(), which are looked up here or found
+ * here when opened, report their writes, so writes to ordinary files
+ * never take the lock.  Every invalidation advances a generation
+ * number, and a load that parsed the headers while the generation
+ * moved does not insert its result, which might be stale. */
+
+#include "userprog/exec_cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include "devices/disk.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Executables cached. */
+#define EXEC_CACHE_SIZE 32
+
+/* A cached executable. */
+struct exec_entry {
+	struct hash_elem hash_elem;   /* Element in ENTRIES. */
+	struct list_elem lru_elem;    /* Element in LRU, most recent first. */
+	disk_sector_t inumber;        /* Inode of the executable. */
+	struct exec_image image;
+};
+
+static struct lock cache_lock;        /* Protects everything below. */
+static struct hash entries;           /* Entries by inode number. */
+static struct list lru;               /* Entries, most recently used first. */
+static unsigned generation;           /* Invalidations so far. */
+
+/* Statistics. */
+static long long hit_cnt;             /* Loads that skipped the headers. */
+static long long miss_cnt;            /* Loads that parsed them. */
+static long long invalidate_cnt;      /* Entries dropped by writes. */
+
+static uint64_t entry_hash (const struct hash_elem *, void *);
+static bool entry_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+
+void
+exec_cache_init (void) {
+	lock_init (&cache_lock);
+	list_init (&lru);
+	if (!hash_init (&entries, entry_hash, entry_less, NULL))
+		PANIC ("exec_cache_init: out of memory");
+}
+
+/* Returns the entry of INUMBER, or a null pointer.  The caller must
+ * hold CACHE_LOCK. */
+static struct exec_entry *
+entry_find (disk_sector_t inumber) {
+	struct exec_entry key;
+	struct hash_elem *e;
+
+	key.inumber = inumber;
+	e = hash_find (&entries, &key.hash_elem);
+	return e != NULL ? hash_entry (e, struct exec_entry, hash_elem) : NULL;
+}
+
+/* Removes ENTRY from the cache and frees it.  The caller must hold
+ * CACHE_LOCK. */
+static void
+entry_remove (struct exec_entry *entry) {
+	hash_delete (&entries, &entry->hash_elem);
+	list_remove (&entry->lru_elem);
+	free (entry);
+}
+
+/* Copies the cached layout of the executable INODE into IMAGE and
+ * returns true, if it is cached.  Otherwise stores the current
+ * generation into *GEN, for exec_cache_insert(), and returns false. */
+bool
+exec_cache_lookup (struct inode *inode, struct exec_image *image,
+		unsigned *gen) {
+	struct exec_entry *entry;
+
+	/* From now on, writes to INODE invalidate it, also while the
+	 * caller parses the headers. */
+	inode_mark_exec_cached (inode);
+
+	lock_acquire (&cache_lock);
+	entry = entry_find (inode_get_inumber (inode));
+	if (entry != NULL) {
+		*image = entry->image;
+		list_remove (&entry->lru_elem);
+		list_push_front (&lru, &entry->lru_elem);
+		hit_cnt++;
+	} else {
+		*gen = generation;
+		miss_cnt++;
+	}
+	lock_release (&cache_lock);
+	return entry != NULL;
+}
+
+/* Caches IMAGE as the layout of the executable INODE, parsed from the
+ * headers since exec_cache_lookup() returned GEN, unless a file was
+ * written meanwhile.  Evicts the least recently used entry if the
+ * cache is full. */
+void
+exec_cache_insert (struct inode *inode, const struct exec_image *image,
+		unsigned gen) {
+	disk_sector_t inumber = inode_get_inumber (inode);
+	struct exec_entry *entry = malloc (sizeof *entry);
+
+	if (entry == NULL)
+		return;
+	entry->inumber = inumber;
+	entry->image = *image;
+
+	lock_acquire (&cache_lock);
+	if (gen != generation || entry_find (inumber) != NULL) {
+		lock_release (&cache_lock);
+		free (entry);
+		return;
+	}
+	if (hash_size (&entries) >= EXEC_CACHE_SIZE)
+		entry_remove (list_entry (list_back (&lru), struct exec_entry,
+					lru_elem));
+	hash_insert (&entries, &entry->hash_elem);
+	list_push_front (&lru, &entry->lru_elem);
+	lock_release (&cache_lock);
+}
+
+/* Returns true if the layout of INODE, which is being opened, is
+ * cached. */
+bool
+exec_cache_contains (struct inode *inode) {
+	bool found;
+
+	lock_acquire (&cache_lock);
+	found = entry_find (inode_get_inumber (inode)) != NULL;
+	lock_release (&cache_lock);
+	return found;
+}
+
+/* Forgets the layout of INODE, which is being written or deleted. */
+void
+exec_cache_invalidate (struct inode *inode) {
+	struct exec_entry *entry;
+
+	lock_acquire (&cache_lock);
+	generation++;
+	entry = entry_find (inode_get_inumber (inode));
+	if (entry != NULL) {
+		entry_remove (entry);
+		invalidate_cnt++;
+	}
+	lock_release (&cache_lock);
+}
+
+void
+exec_cache_print_stats (void) {
+	printf ("Exec cache: %zu executables, %lld hits, %lld misses, "
+			"%lld invalidated\n", hash_size (&entries), hit_cnt, miss_cnt,
+			invalidate_cnt);
+}
+
+/* Hash function and comparison for cache entries. */
+static uint64_t
+entry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct exec_entry, hash_elem)->inumber);
+}
+
+static bool
+entry_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct exec_entry, hash_elem)->inumber
+		< hash_entry (b, struct exec_entry, hash_elem)->inumber;
+}
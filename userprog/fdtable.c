@@ -0,0 +1,172 @@
+#include "userprog/fdtable.h"
+#include <debug.h>
+#include <stdio.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+
+/* Returns a new open file for FILE, or for the console CONSOLE if
+ * FILE is null, with no descriptor referring to it yet.  Returns a
+ * null pointer if memory is short. */
+static struct open_file *
+open_file_create (struct file *file, int console) {
+	struct open_file *of = malloc (sizeof *of);
+
+	if (of != NULL) {
+		of->file = file;
+		of->console = console;
+		of->ref_cnt = 0;
+	}
+	return of;
+}
+
+/* Drops a descriptor's reference to OF, closing it with the last. */
+static void
+open_file_release (struct open_file *of) {
+	ASSERT (of->ref_cnt > 0);
+	if (--of->ref_cnt == 0) {
+		file_close (of->file);
+		free (of);
+	}
+}
+
+/* Returns a new table with the console open as STDIN_FILENO and
+ * STDOUT_FILENO, or a null pointer if memory is short. */
+struct fd_table *
+fd_table_create (void) {
+	struct fd_table *t = calloc (1, sizeof *t);
+	int fd;
+
+	if (t == NULL)
+		return NULL;
+	for (fd = STDIN_FILENO; fd <= STDOUT_FILENO; fd++) {
+		t->files[fd] = open_file_create (NULL, fd);
+		if (t->files[fd] == NULL) {
+			fd_table_destroy (t);
+			return NULL;
+		}
+		t->files[fd]->ref_cnt = 1;
+	}
+	return t;
+}
+
+/* Returns a copy of SRC for a new process.  Each open file is
+ * duplicated with its position, and descriptors that share one in
+ * SRC share its copy.  Returns a null pointer if memory is short. */
+struct fd_table *
+fd_table_duplicate (const struct fd_table *src) {
+	struct fd_table *t = calloc (1, sizeof *t);
+	int fd, i;
+
+	if (t == NULL)
+		return NULL;
+	for (fd = 0; fd < FD_MAX; fd++) {
+		struct open_file *of = src->files[fd];
+
+		if (of == NULL)
+			continue;
+		for (i = 0; i < fd; i++)
+			if (src->files[i] == of)
+				break;
+		if (i < fd)
+			t->files[fd] = t->files[i];
+		else {
+			struct file *file = NULL;
+
+			if (of->file != NULL
+					&& (file = file_duplicate (of->file)) == NULL)
+				goto fail;
+			t->files[fd] = open_file_create (file, of->console);
+			if (t->files[fd] == NULL) {
+				file_close (file);
+				goto fail;
+			}
+		}
+		t->files[fd]->ref_cnt++;
+	}
+	return t;
+
+fail:
+	fd_table_destroy (t);
+	return NULL;
+}
+
+/* Closes every descriptor in T and frees it. */
+void
+fd_table_destroy (struct fd_table *t) {
+	int fd;
+
+	if (t == NULL)
+		return;
+	for (fd = 0; fd < FD_MAX; fd++)
+		if (t->files[fd] != NULL)
+			open_file_release (t->files[fd]);
+	free (t);
+}
+
+/* Returns the open file of descriptor FD in T, or a null pointer if
+ * FD is not open. */
+struct open_file *
+fd_lookup (struct fd_table *t, int fd) {
+	if (t == NULL || fd < 0 || fd >= FD_MAX)
+		return NULL;
+	return t->files[fd];
+}
+
+/* Returns the file of descriptor FD in T, or a null pointer if FD is
+ * not open or is the console. */
+struct file *
+fd_file (struct fd_table *t, int fd) {
+	struct open_file *of = fd_lookup (t, fd);
+
+	return of != NULL ? of->file : NULL;
+}
+
+/* Opens FILE as the lowest free descriptor of T, which takes it
+ * over, and returns the descriptor.  Returns -1, and closes FILE, if
+ * no descriptor is free or memory is short. */
+int
+fd_install (struct fd_table *t, struct file *file) {
+	int fd;
+
+	ASSERT (file != NULL);
+	for (fd = 0; fd < FD_MAX; fd++)
+		if (t->files[fd] == NULL) {
+			t->files[fd] = open_file_create (file, -1);
+			if (t->files[fd] == NULL)
+				break;
+			t->files[fd]->ref_cnt = 1;
+			return fd;
+		}
+	file_close (file);
+	return -1;
+}
+
+/* Closes descriptor FD of T.  Returns false if it was not open. */
+bool
+fd_close (struct fd_table *t, int fd) {
+	struct open_file *of = fd_lookup (t, fd);
+
+	if (of == NULL)
+		return false;
+	t->files[fd] = NULL;
+	open_file_release (of);
+	return true;
+}
+
+/* Makes NEWFD of T refer to the open file of OLDFD, closing NEWFD
+ * first if it was open.  Returns NEWFD, or -1 if OLDFD is not open or
+ * NEWFD is out of range. */
+int
+fd_dup2 (struct fd_table *t, int oldfd, int newfd) {
+	struct open_file *of = fd_lookup (t, oldfd);
+
+	if (of == NULL || newfd < 0 || newfd >= FD_MAX)
+		return -1;
+	if (t->files[newfd] != of) {
+		if (t->files[newfd] != NULL)
+			open_file_release (t->files[newfd]);
+		t->files[newfd] = of;
+		of->ref_cnt++;
+	}
+	return newfd;
+}
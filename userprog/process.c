@@ -7,6 +7,9 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/tss.h"
+#include "userprog/exec_cache.h"
+#include "userprog/fdtable.h"
+#include "userprog/syscall.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -17,15 +20,85 @@
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
+#include "threads/malloc.h"
 #include "intrinsic.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/rss.h"
 #endif
 
 static void process_cleanup (void);
-static bool load (const char *file_name, struct intr_frame *if_);
-static void initd (void *f_name);
+static bool load (char *cmd_line, struct intr_frame *if_);
+static void initd (void *aux);
 static void __do_fork (void *);
+static void __do_vfork (void *);
+static void spawnd (void *aux);
+#ifndef VM
+static bool install_pages (void *upage, void **kpages, size_t cnt,
+		bool writable);
+#endif
+
+/* What a child process leaves its parent: its exit status.  The child
+ * and its parent each hold a reference, and whichever lets go last
+ * frees it, so that neither has to outlive the other. */
+struct exit_record {
+	tid_t tid;                          /* The child's thread id. */
+	int status;                         /* Its exit status. */
+	struct semaphore exited;            /* Upped when the child exits. */
+	int ref_cnt;                        /* References left, up to 2. */
+	struct list_elem elem;              /* In the parent's children. */
+};
+
+/* Returns a new exit record, referenced by a parent and a child that
+ * is about to be created, or a null pointer if memory is short. */
+static struct exit_record *
+exit_record_create (void) {
+	struct exit_record *rec = malloc (sizeof *rec);
+
+	if (rec != NULL) {
+		rec->tid = TID_ERROR;
+		rec->status = -1;
+		sema_init (&rec->exited, 0);
+		rec->ref_cnt = 2;
+	}
+	return rec;
+}
+
+/* Drops a reference to REC, freeing it with the last. */
+static void
+exit_record_release (struct exit_record *rec) {
+	enum intr_level old_level = intr_disable ();
+	bool last = --rec->ref_cnt == 0;
+
+	intr_set_level (old_level);
+	if (last)
+		free (rec);
+}
+
+/* Adds REC, the exit record of child TID, to the current thread's
+ * children, or frees it if the child could not be created.  Returns
+ * TID. */
+static tid_t
+adopt_child (struct exit_record *rec, tid_t tid) {
+	if (tid == TID_ERROR) {
+		free (rec);
+		return TID_ERROR;
+	}
+	rec->tid = tid;
+	list_push_back (&thread_current ()->children, &rec->elem);
+	return tid;
+}
+
+/* Stores the first word of CMD_LINE, the program's name, into NAME,
+ * a buffer of SIZE bytes. */
+static void
+program_name (char *name, size_t size, const char *cmd_line) {
+	size_t len;
+
+	cmd_line += strspn (cmd_line, " ");
+	len = strcspn (cmd_line, " ");
+	strlcpy (name, cmd_line, len + 1 < size ? len + 1 : size);
+}
 
 /* General process initializer for initd and other process. */
 static void
@@ -33,6 +106,48 @@ process_init (void) {
 	struct thread *current = thread_current ();
 }
 
+/* Arguments of initd() and spawnd(), on the stack of the parent,
+ * which waits until the child has started. */
+struct spawn_args {
+	char *cmd_line;                     /* Page holding the command line. */
+	struct fd_table *fds;               /* The child's descriptors. */
+	struct thread *parent;              /* The spawning process. */
+	struct exit_record *rec;            /* The child's exit record. */
+	struct semaphore started;           /* Upped by the child. */
+};
+
+/* Starts a child process of the current thread that runs FUNCTION,
+ * with a struct spawn_args for CMD_LINE and FDS, which the child takes
+ * over.  Returns the child's thread id once it has started, or
+ * TID_ERROR if it cannot be created. */
+static tid_t
+start_process (char *cmd_line, struct fd_table *fds, thread_func *function) {
+	struct spawn_args args = {
+		.cmd_line = cmd_line,
+		.fds = fds,
+		.parent = thread_current (),
+	};
+	char name[sizeof args.parent->name];
+	tid_t tid = TID_ERROR;
+
+	args.rec = exit_record_create ();
+	if (args.rec != NULL) {
+		sema_init (&args.started, 0);
+		program_name (name, sizeof name, cmd_line);
+		tid = adopt_child (args.rec,
+				thread_create (name, PRI_DEFAULT, function, &args));
+	}
+	if (tid == TID_ERROR) {
+		palloc_free_page (cmd_line);
+		lock_acquire (&filesys_lock);
+		fd_table_destroy (fds);
+		lock_release (&filesys_lock);
+		return TID_ERROR;
+	}
+	sema_down (&args.started);
+	return tid;
+}
+
 /* Starts the first userland program, called "initd", loaded from FILE_NAME.
  * The new thread may be scheduled (and may even exit)
  * before process_create_initd() returns. Returns the initd's
@@ -41,7 +156,7 @@ process_init (void) {
 tid_t
 process_create_initd (const char *file_name) {
 	char *fn_copy;
-	tid_t tid;
+	struct fd_table *fds;
 
 	/* Make a copy of FILE_NAME.
 	 * Otherwise there's a race between the caller and load(). */
@@ -50,83 +165,272 @@ process_create_initd (const char *file_name) {
 		return TID_ERROR;
 	strlcpy (fn_copy, file_name, PGSIZE);
 
-	/* Create a new thread to execute FILE_NAME. */
-	tid = thread_create (file_name, PRI_DEFAULT, initd, fn_copy);
-	if (tid == TID_ERROR)
+	/* It starts with just the console open. */
+	fds = fd_table_create ();
+	if (fds == NULL) {
 		palloc_free_page (fn_copy);
-	return tid;
+		return TID_ERROR;
+	}
+
+	/* Create a new thread to execute FILE_NAME. */
+	return start_process (fn_copy, fds, initd);
 }
 
 /* A thread function that launches first user process. */
 static void
-initd (void *f_name) {
+initd (void *aux) {
+	struct spawn_args *args = aux;
+	struct thread *current = thread_current ();
+	char *f_name = args->cmd_line;
+
+	current->exit_rec = args->rec;
 #ifdef VM
-	supplemental_page_table_init (&thread_current ()->spt);
+	supplemental_page_table_init (&current->spt);
 #endif
 
 	process_init ();
 
+	current->fds = args->fds;
+	/* ARGS is gone once the parent runs again. */
+	sema_up (&args->started);
 	if (process_exec (f_name) < 0)
 		PANIC("Fail to launch initd\n");
 	NOT_REACHED ();
 }
 
-/* Clones the current process as `name`. Returns the new process's thread id, or
- * TID_ERROR if the thread cannot be created. */
+/* Starts a new process running CMD_LINE, a page that it takes over,
+ * with the file descriptors FDS, which it takes over too.  Nothing of
+ * the current process is copied: the child builds a fresh address
+ * space right away, so the cost does not depend on the size of the
+ * parent.  Returns the new process's thread id, or TID_ERROR if the
+ * thread cannot be created. */
 tid_t
-process_fork (const char *name, struct intr_frame *if_ UNUSED) {
+process_spawn (char *cmd_line, struct fd_table *fds) {
+	return start_process (cmd_line, fds, spawnd);
+}
+
+/* A thread function that starts a spawned process. */
+static void
+spawnd (void *aux) {
+	struct spawn_args *args = aux;
+	struct thread *current = thread_current ();
+	char *cmd_line = args->cmd_line;
+
+	current->exit_rec = args->rec;
+#ifdef VM
+	supplemental_page_table_init (&current->spt);
+	rss_inherit (current, args->parent);
+#endif
+	process_init ();
+
+	current->fds = args->fds;
+	/* ARGS is gone once the parent runs again. */
+	sema_up (&args->started);
+	process_exec (cmd_line);
+	thread_exit ();
+}
+
+/* Arguments of __do_vfork(), on the stack of the parent, which is
+ * suspended until the child gives its address space back. */
+struct vfork_args {
+	struct thread *parent;
+	struct intr_frame *if_;             /* The parent's user context. */
+	struct exit_record *rec;            /* The child's exit record. */
+	bool success;                       /* Did the child start? */
+};
+
+/* Creates a child, `name`, that runs in the address space of the
+ * current process, from the user context IF_, until it calls exec()
+ * or exits.  The current process is suspended until then.  Returns
+ * the new process's thread id, or TID_ERROR if the thread cannot be
+ * created. */
+tid_t
+process_vfork (const char *name, struct intr_frame *if_) {
+	struct thread *cur = thread_current ();
+	struct vfork_args args = { .parent = cur, .if_ = if_ };
+	tid_t tid;
+
+	/* A vfork() child may not lend out what it only borrows. */
+	if (cur->vfork_parent != NULL
+			|| (args.rec = exit_record_create ()) == NULL)
+		return TID_ERROR;
+	tid = adopt_child (args.rec,
+			thread_create (name, PRI_DEFAULT, __do_vfork, &args));
+	if (tid == TID_ERROR)
+		return TID_ERROR;
+	sema_down (&cur->vfork_sema);
+	return args.success ? tid : TID_ERROR;
+}
+
+/* A thread function that runs a vfork() child in its parent's
+ * address space. */
+static void
+__do_vfork (void *aux) {
+	struct vfork_args *args = aux;
+	struct thread *current = thread_current ();
+	struct intr_frame if_;
+
+	current->exit_rec = args->rec;
+	memcpy (&if_, args->if_, sizeof if_);
+	if_.R.rax = 0;
+
+	/* The descriptors are our own, as after fork(). */
+	lock_acquire (&filesys_lock);
+	current->fds = fd_table_duplicate (args->parent->fds);
+	lock_release (&filesys_lock);
+	args->success = current->fds != NULL;
+	if (current->fds == NULL) {
+		sema_up (&args->parent->vfork_sema);
+		thread_exit ();
+	}
+#ifdef VM
+	/* Stays empty until exec(); faults go to the parent's. */
+	supplemental_page_table_init (&current->spt);
+	rss_inherit (current, args->parent);
+#endif
+	current->vfork_parent = args->parent;
+	current->pml4 = args->parent->pml4;
+	process_activate (current);
+	process_init ();
+	do_iret (&if_);
+	NOT_REACHED ();
+}
+
+/* Arguments of __do_fork(), on the stack of the parent, which waits
+ * until the child has copied it. */
+struct fork_args {
+	struct thread *parent;
+	struct intr_frame *if_;             /* The parent's user context. */
+	struct exit_record *rec;            /* The child's exit record. */
+	struct semaphore done;              /* Upped when the copy is over. */
+	bool success;                       /* Did the copy succeed? */
+};
+
+/* Clones the current process as `name`, from the user context IF_.
+ * Returns the new process's thread id, or TID_ERROR if the thread
+ * cannot be created or the process cannot be copied. */
+tid_t
+process_fork (const char *name, struct intr_frame *if_) {
+	struct thread *cur = thread_current ();
+	struct fork_args args = { .parent = cur, .if_ = if_ };
+	tid_t tid;
+
+	/* A vfork() child has nothing of its own to copy. */
+	if (cur->vfork_parent != NULL
+			|| (args.rec = exit_record_create ()) == NULL)
+		return TID_ERROR;
+	sema_init (&args.done, 0);
+
 	/* Clone current thread to new thread.*/
-	return thread_create (name,
-			PRI_DEFAULT, __do_fork, thread_current ());
+	tid = adopt_child (args.rec,
+			thread_create (name, PRI_DEFAULT, __do_fork, &args));
+	if (tid == TID_ERROR)
+		return TID_ERROR;
+	sema_down (&args.done);
+	return args.success ? tid : TID_ERROR;
 }
 
 #ifndef VM
-/* Duplicate the parent's address space by passing this function to the
- * pml4_for_each. This is only for the project 2. */
+/* Pages of the child collected by duplicate_pte(), to be mapped with
+ * one pml4_map_range() per run of contiguous pages. */
+struct fork_batch {
+	uint8_t *start;                 /* Address of KPAGES[0]. */
+	size_t cnt;                     /* Number of pages in KPAGES. */
+	bool writable;                  /* Whether they are writable. */
+	void **kpages;                  /* One page worth of frames. */
+};
+
+#define FORK_BATCH_MAX (PGSIZE / sizeof (void *))
+
+/* Maps the pages in BATCH into the current thread's address space.
+ * Those that are not mapped on failure are freed. */
+static bool
+fork_batch_flush (struct fork_batch *b) {
+	bool success = install_pages (b->start, b->kpages, b->cnt, b->writable);
+
+	if (!success)
+		for (size_t i = 0; i < b->cnt; i++)
+			palloc_free_page (b->kpages[i]);
+	b->cnt = 0;
+	return success;
+}
+
+/* Duplicate the parent's address space by passing this function to
+ * pml4_walk_range().  This is only for the project 2. */
 static bool
 duplicate_pte (uint64_t *pte, void *va, void *aux) {
-	struct thread *current = thread_current ();
-	struct thread *parent = (struct thread *) aux;
+	struct fork_batch *b = aux;
 	void *parent_page;
 	void *newpage;
 	bool writable;
 
-	/* 1. TODO: If the parent_page is kernel page, then return immediately. */
-
-	/* 2. Resolve VA from the parent's page map level 4. */
-	parent_page = pml4_get_page (parent->pml4, va);
-
-	/* 3. TODO: Allocate new PAL_USER page for the child and set result to
-	 *    TODO: NEWPAGE. */
-
-	/* 4. TODO: Duplicate parent's page to the new page and
-	 *    TODO: check whether parent's page is writable or not (set WRITABLE
-	 *    TODO: according to the result). */
+	/* 1. Resolve VA from the parent's page map level 4. */
+	parent_page = ptov (PTE_ADDR (*pte));
 
-	/* 5. Add new page to child's page table at address VA with WRITABLE
-	 *    permission. */
-	if (!pml4_set_page (current->pml4, va, newpage, writable)) {
-		/* 6. TODO: if fail to insert page, do error handling. */
+	/* 2. Allocate new PAL_USER page for the child and duplicate the
+	 *    parent's page to it, with the same permission. */
+	newpage = palloc_get_page (PAL_USER);
+	if (newpage == NULL)
+		return false;
+	memcpy (newpage, parent_page, PGSIZE);
+	writable = is_writable (pte);
+
+	/* 3. Add the page to the batch, mapping the batch first if VA does
+	 *    not extend it. */
+	if (b->cnt > 0 && (b->cnt == FORK_BATCH_MAX || writable != b->writable
+				|| (uint8_t *) va != b->start + b->cnt * PGSIZE)
+			&& !fork_batch_flush (b)) {
+		palloc_free_page (newpage);
+		return false;
 	}
+	if (b->cnt == 0) {
+		b->start = va;
+		b->writable = writable;
+	}
+	b->kpages[b->cnt++] = newpage;
 	return true;
 }
+
+/* Duplicates the user pages of PARENT into the current thread's
+ * address space.  Only the parts of the parent's page table that are
+ * present are walked. */
+static bool
+duplicate_address_space (struct thread *parent) {
+	struct fork_batch b = { .cnt = 0 };
+	bool success;
+
+	b.kpages = palloc_get_page (0);
+	if (b.kpages == NULL)
+		return false;
+	success = pml4_walk_range (parent->pml4, NULL, (void *) KERN_BASE, false,
+			duplicate_pte, &b);
+	if (!success) {
+		while (b.cnt > 0)
+			palloc_free_page (b.kpages[--b.cnt]);
+	} else if (b.cnt > 0)
+		success = fork_batch_flush (&b);
+	palloc_free_page (b.kpages);
+	return success;
+}
 #endif
 
 /* A thread function that copies parent's execution context.
- * Hint) parent->tf does not hold the userland context of the process.
- *       That is, you are required to pass second argument of process_fork to
- *       this function. */
+ * parent->tf does not hold the userland context of the process, so it
+ * comes from process_fork()'s IF_, in AUX. */
 static void
 __do_fork (void *aux) {
 	struct intr_frame if_;
-	struct thread *parent = (struct thread *) aux;
+	struct fork_args *args = aux;
+	struct thread *parent = args->parent;
 	struct thread *current = thread_current ();
-	/* TODO: somehow pass the parent_if. (i.e. process_fork()'s if_) */
-	struct intr_frame *parent_if;
-	bool succ = true;
+	struct intr_frame *parent_if = args->if_;
 
-	/* 1. Read the cpu context to local stack. */
+	current->exit_rec = args->rec;
+
+	/* 1. Read the cpu context to local stack.  The child's fork()
+	 *    returns 0. */
 	memcpy (&if_, parent_if, sizeof (struct intr_frame));
+	if_.R.rax = 0;
 
 	/* 2. Duplicate PT */
 	current->pml4 = pml4_create();
@@ -135,26 +439,31 @@ __do_fork (void *aux) {
 
 	process_activate (current);
 #ifdef VM
+	rss_inherit (current, parent);
 	supplemental_page_table_init (&current->spt);
 	if (!supplemental_page_table_copy (&current->spt, &parent->spt))
 		goto error;
 #else
-	if (!pml4_for_each (parent->pml4, duplicate_pte, parent))
+	if (!duplicate_address_space (parent))
 		goto error;
 #endif
 
-	/* TODO: Your code goes here.
-	 * TODO: Hint) To duplicate the file object, use `file_duplicate`
-	 * TODO:       in include/filesys/file.h. Note that parent should not return
-	 * TODO:       from the fork() until this function successfully duplicates
-	 * TODO:       the resources of parent.*/
+	/* 3. Duplicate the file descriptors.  The parent does not return
+	 *    from fork() until this is done. */
+	lock_acquire (&filesys_lock);
+	current->fds = fd_table_duplicate (parent->fds);
+	lock_release (&filesys_lock);
+	if (current->fds == NULL)
+		goto error;
 
 	process_init ();
 
 	/* Finally, switch to the newly created process. */
-	if (succ)
-		do_iret (&if_);
+	args->success = true;
+	sema_up (&args->done);
+	do_iret (&if_);
 error:
+	sema_up (&args->done);
 	thread_exit ();
 }
 
@@ -195,15 +504,26 @@ process_exec (void *f_name) {
  * exception), returns -1.  If TID is invalid or if it was not a
  * child of the calling process, or if process_wait() has already
  * been successfully called for the given TID, returns -1
- * immediately, without waiting.
- *
- * This function will be implemented in problem 2-2.  For now, it
- * does nothing. */
+ * immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) {
-	/* XXX: Hint) The pintos exit if process_wait (initd), we recommend you
-	 * XXX:       to add infinite loop here before
-	 * XXX:       implementing the process_wait. */
+process_wait (tid_t child_tid) {
+	struct list *children = &thread_current ()->children;
+	struct list_elem *e;
+
+	for (e = list_begin (children); e != list_end (children);
+			e = list_next (e)) {
+		struct exit_record *rec = list_entry (e, struct exit_record, elem);
+
+		if (rec->tid == child_tid) {
+			int status;
+
+			sema_down (&rec->exited);
+			status = rec->status;
+			list_remove (&rec->elem);
+			exit_record_release (rec);
+			return status;
+		}
+	}
 	return -1;
 }
 
@@ -211,23 +531,60 @@ process_wait (tid_t child_tid UNUSED) {
 void
 process_exit (void) {
 	struct thread *curr = thread_current ();
-	/* TODO: Your code goes here.
-	 * TODO: Implement process termination message (see
-	 * TODO: project2/process_termination.html).
-	 * TODO: We recommend you to implement process resource cleanup here. */
+	struct exit_record *rec = curr->exit_rec;
+
+	/* Only threads started as processes have a record. */
+	if (rec != NULL)
+		printf ("%s: exit(%d)\n", curr->name, curr->exit_status);
 
+	if (curr->fds != NULL) {
+		lock_acquire (&filesys_lock);
+		fd_table_destroy (curr->fds);
+		lock_release (&filesys_lock);
+		curr->fds = NULL;
+	}
 	process_cleanup ();
+
+	/* Nobody is left to wait for our children. */
+	while (!list_empty (&curr->children))
+		exit_record_release (list_entry (list_pop_front (&curr->children),
+					struct exit_record, elem));
+	if (rec != NULL) {
+		rec->status = curr->exit_status;
+		curr->exit_rec = NULL;
+		sema_up (&rec->exited);
+		exit_record_release (rec);
+	}
 }
 
-/* Free the current process's resources. */
+/* Free the current process's resources.  A vfork() child gives the
+ * address space it borrows back to its parent, which runs again,
+ * instead of destroying it. */
 static void
 process_cleanup (void) {
 	struct thread *curr = thread_current ();
 
+	if (curr->vfork_parent != NULL) {
+		struct thread *parent = curr->vfork_parent;
+
+		curr->pml4 = NULL;
+		curr->vfork_parent = NULL;
+		pml4_activate (NULL);
+		sema_up (&parent->vfork_sema);
+	}
+
 #ifdef VM
 	supplemental_page_table_kill (&curr->spt);
 #endif
 
+	/* Let our executable be written again. */
+	if (curr->exec_file != NULL) {
+		lock_acquire (&filesys_lock);
+		file_close (curr->exec_file);
+		lock_release (&filesys_lock);
+		curr->exec_file = NULL;
+	}
+
 	uint64_t *pml4;
 	/* Destroy the current process's page directory and switch back
 	 * to the kernel-only page directory. */
@@ -247,11 +604,19 @@ process_cleanup (void) {
 }
 
 /* Sets up the CPU for running user code in the nest thread.
- * This function is called on every context switch. */
+ * This function is called on every context switch.
+ *
+ * A kernel thread (one without a pml4) only touches kernel mappings,
+ * which every pml4 shares, so it borrows whatever address space is
+ * loaded instead of switching to base_pml4.  CR3 is only written
+ * when a different user pml4 has to run.  pml4_destroy() moves the
+ * CPU off a pml4 before freeing it, so a borrowed pml4 never
+ * outlives its owner. */
 void
 process_activate (struct thread *next) {
 	/* Activate thread's page tables. */
-	pml4_activate (next->pml4);
+	if (next->pml4 != NULL)
+		pml4_activate (next->pml4);
 
 	/* Set thread's kernel stack for use in processing interrupts. */
 	tss_update (next);
@@ -316,33 +681,26 @@ static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		uint32_t read_bytes, uint32_t zero_bytes,
 		bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
- * Stores the executable's entry point into *RIP
- * and its initial stack pointer into *RSP.
- * Returns true if successful, false otherwise. */
+static bool map_segment (struct file *, const struct exec_segment *,
+		uintptr_t *heap_base);
+
+/* Reads the ELF header and the program headers of FILE, the
+ * executable FILE_NAME, validates them, and stores the layout of the
+ * program into IMAGE.  IMAGE->seg_cnt counts every loadable segment,
+ * but only the first EXEC_SEGMENTS_MAX fit in IMAGE.  If HEAP_BASE is
+ * non-null, each segment is instead mapped as soon as it is validated,
+ * raising *HEAP_BASE above it, which is how executables with more
+ * segments than that load.  Returns true if successful, false
+ * otherwise. */
 static bool
-load (const char *file_name, struct intr_frame *if_) {
-	struct thread *t = thread_current ();
+read_image (const char *file_name, struct file *file,
+		struct exec_image *image, uintptr_t *heap_base) {
 	struct ELF ehdr;
-	struct file *file = NULL;
 	off_t file_ofs;
-	bool success = false;
 	int i;
 
-	/* Allocate and activate page directory. */
-	t->pml4 = pml4_create ();
-	if (t->pml4 == NULL)
-		goto done;
-	process_activate (thread_current ());
-
-	/* Open executable file. */
-	file = filesys_open (file_name);
-	if (file == NULL) {
-		printf ("load: %s: open failed\n", file_name);
-		goto done;
-	}
-
 	/* Read and verify executable header. */
+	file_seek (file, 0);
 	if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
 			|| memcmp (ehdr.e_ident, "\177ELF\2\1\1", 7)
 			|| ehdr.e_type != 2
@@ -351,8 +709,10 @@ load (const char *file_name, struct intr_frame *if_) {
 			|| ehdr.e_phentsize != sizeof (struct Phdr)
 			|| ehdr.e_phnum > 1024) {
 		printf ("load: %s: error loading executable\n", file_name);
-		goto done;
+		return false;
 	}
+	image->entry = ehdr.e_entry;
+	image->seg_cnt = 0;
 
 	/* Read program headers. */
 	file_ofs = ehdr.e_phoff;
@@ -360,11 +720,11 @@ load (const char *file_name, struct intr_frame *if_) {
 		struct Phdr phdr;
 
 		if (file_ofs < 0 || file_ofs > file_length (file))
-			goto done;
+			return false;
 		file_seek (file, file_ofs);
 
 		if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-			goto done;
+			return false;
 		file_ofs += sizeof phdr;
 		switch (phdr.p_type) {
 			case PT_NULL:
@@ -377,51 +737,209 @@ load (const char *file_name, struct intr_frame *if_) {
 			case PT_DYNAMIC:
 			case PT_INTERP:
 			case PT_SHLIB:
-				goto done;
+				return false;
 			case PT_LOAD:
 				if (validate_segment (&phdr, file)) {
-					bool writable = (phdr.p_flags & PF_W) != 0;
-					uint64_t file_page = phdr.p_offset & ~PGMASK;
-					uint64_t mem_page = phdr.p_vaddr & ~PGMASK;
+					struct exec_segment seg;
 					uint64_t page_offset = phdr.p_vaddr & PGMASK;
-					uint32_t read_bytes, zero_bytes;
+
+					seg.writable = (phdr.p_flags & PF_W) != 0;
+					seg.ofs = phdr.p_offset & ~PGMASK;
+					seg.upage = phdr.p_vaddr & ~PGMASK;
 					if (phdr.p_filesz > 0) {
 						/* Normal segment.
 						 * Read initial part from disk and zero the rest. */
-						read_bytes = page_offset + phdr.p_filesz;
-						zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-								- read_bytes);
+						seg.read_bytes = page_offset + phdr.p_filesz;
+						seg.zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz,
+									PGSIZE) - seg.read_bytes);
 					} else {
 						/* Entirely zero.
 						 * Don't read anything from disk. */
-						read_bytes = 0;
-						zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
+						seg.read_bytes = 0;
+						seg.zero_bytes = ROUND_UP (page_offset + phdr.p_memsz,
+								PGSIZE);
 					}
-					if (!load_segment (file, file_page, (void *) mem_page,
-								read_bytes, zero_bytes, writable))
-						goto done;
+					if (heap_base != NULL) {
+						if (!map_segment (file, &seg, heap_base))
+							return false;
+					} else if (image->seg_cnt < EXEC_SEGMENTS_MAX)
+						image->segs[image->seg_cnt] = seg;
+					image->seg_cnt++;
 				}
 				else
-					goto done;
+					return false;
 				break;
 		}
 	}
+	return true;
+}
+
+/* Maps SEG of FILE and raises *HEAP_BASE above it.  Returns true if
+ * successful, false otherwise. */
+static bool
+map_segment (struct file *file, const struct exec_segment *seg,
+		uintptr_t *heap_base) {
+	uintptr_t end = seg->upage + seg->read_bytes + seg->zero_bytes;
+
+	if (!load_segment (file, seg->ofs, (void *) seg->upage,
+				seg->read_bytes, seg->zero_bytes, seg->writable))
+		return false;
+	if (end > *heap_base)
+		*heap_base = end;
+	return true;
+}
+
+/* Splits CMD_LINE into its words in place, packing them one after
+ * another with their null terminators, so that CMD_LINE reads as the
+ * first word, the program's name.  Returns the number of words and
+ * stores the size of the packed words into *SIZE. */
+static int
+split_args (char *cmd_line, size_t *size) {
+	char *dst = cmd_line;
+	char *token, *save_ptr;
+	int argc = 0;
+
+	for (token = strtok_r (cmd_line, " ", &save_ptr); token != NULL;
+			token = strtok_r (NULL, " ", &save_ptr)) {
+		size_t len = strlen (token) + 1;
+
+		memmove (dst, token, len);
+		dst += len;
+		argc++;
+	}
+	*size = dst - cmd_line;
+	return argc;
+}
+
+/* Pushes the ARGC words packed into the SIZE bytes at ARGS onto the
+ * user stack of IF_, followed by the argv array that points to them
+ * and a null return address, and passes argc and argv to the program
+ * in RDI and RSI.  Returns false if they do not fit in the stack's
+ * first page. */
+static bool
+push_args (struct intr_frame *if_, const char *args, size_t size,
+		int argc) {
+	uint8_t *rsp = (uint8_t *) if_->rsp;
+	char **argv;
+	char *word;
+	int i;
+
+	if (ROUND_UP (size, sizeof *argv) + (argc + 2) * sizeof *argv > PGSIZE)
+		return false;
+	rsp -= size;
+	memcpy (rsp, args, size);
+	word = (char *) rsp;
+
+	rsp = (uint8_t *) ROUND_DOWN ((uintptr_t) rsp, sizeof *argv);
+	argv = (char **) rsp - (argc + 1);
+	for (i = 0; i < argc; i++) {
+		argv[i] = word;
+		word += strlen (word) + 1;
+	}
+	argv[argc] = NULL;
+
+	rsp = (uint8_t *) (argv - 1);
+	*(void **) rsp = NULL;
+	if_->rsp = (uintptr_t) rsp;
+	if_->R.rdi = argc;
+	if_->R.rsi = (uintptr_t) argv;
+	return true;
+}
+
+/* Loads an ELF executable from CMD_LINE, a program name followed by
+ * its arguments, into the current thread.  CMD_LINE is modified.
+ * Stores the executable's entry point into *RIP
+ * and its initial stack pointer into *RSP.
+ * The layout of the executable comes from the exec cache if it was
+ * run recently, and is added to it otherwise.
+ * Returns true if successful, false otherwise. */
+static bool
+load (char *cmd_line, struct intr_frame *if_) {
+	struct thread *t = thread_current ();
+	struct exec_image *image = NULL;
+	struct file *file = NULL;
+	const char *file_name = cmd_line;
+	bool success = false;
+	uintptr_t heap_base = 0;
+	unsigned gen;
+	size_t args_size;
+	int argc;
+	size_t i;
+
+	/* Allocate and activate page directory. */
+	t->pml4 = pml4_create ();
+	if (t->pml4 == NULL)
+		goto done;
+	process_activate (thread_current ());
+#ifdef VM
+	supplemental_page_table_init (&t->spt);
+#endif
+
+	argc = split_args (cmd_line, &args_size);
+	if (argc == 0)
+		goto done;
+
+	/* Open executable file. */
+	lock_acquire (&filesys_lock);
+	file = filesys_open (file_name);
+	lock_release (&filesys_lock);
+	if (file == NULL) {
+		printf ("load: %s: open failed\n", file_name);
+		goto done;
+	}
+
+	/* Find the layout of the executable. */
+	image = malloc (sizeof *image);
+	if (image == NULL)
+		goto done;
+	if (!exec_cache_lookup (file_get_inode (file), image, &gen)) {
+		if (!read_image (file_name, file, image, NULL))
+			goto done;
+		if (image->seg_cnt <= EXEC_SEGMENTS_MAX)
+			exec_cache_insert (file_get_inode (file), image, gen);
+	}
+
+	/* Map its segments.  One with too many to cache is parsed again,
+	 * mapping them on the way. */
+	if (image->seg_cnt > EXEC_SEGMENTS_MAX) {
+		if (!read_image (file_name, file, image, &heap_base))
+			goto done;
+	} else {
+		for (i = 0; i < image->seg_cnt; i++)
+			if (!map_segment (file, &image->segs[i], &heap_base))
+				goto done;
+	}
+#ifdef VM
+	/* The heap starts out empty, right above the segments. */
+	vm_heap_init ((void *) heap_base);
+#endif
 
 	/* Set up stack. */
 	if (!setup_stack (if_))
 		goto done;
 
 	/* Start address. */
-	if_->rip = ehdr.e_entry;
+	if_->rip = image->entry;
 
-	/* TODO: Your code goes here.
-	 * TODO: Implement argument passing (see project2/argument_passing.html). */
+	if (!push_args (if_, cmd_line, args_size, argc))
+		goto done;
 
+	/* The process goes by the name of its program from now on. */
+	strlcpy (t->name, file_name, sizeof t->name);
 	success = true;
 
 done:
-	/* We arrive here whether the load is successful or not. */
-	file_close (file);
+	/* We arrive here whether the load is successful or not.  The
+	 * executable stays open while it runs, so that it cannot be
+	 * written. */
+	free (image);
+	lock_acquire (&filesys_lock);
+	if (success) {
+		file_deny_write (file);
+		t->exec_file = file;
+	} else
+		file_close (file);
+	lock_release (&filesys_lock);
 	return success;
 }
 
@@ -499,6 +1017,15 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
+	/* The pages are read into a batch of up to MAX_CNT frames, which is
+	 * then mapped with a single walk of the page table. */
+	const size_t max_cnt = PGSIZE / sizeof (void *);
+	void **kpages = palloc_get_page (0);
+	size_t cnt = 0;
+	bool success = true;
+
+	if (kpages == NULL)
+		return false;
 	file_seek (file, ofs);
 	while (read_bytes > 0 || zero_bytes > 0) {
 		/* Do calculate how to fill this page.
@@ -509,29 +1036,38 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 
 		/* Get a page of memory. */
 		uint8_t *kpage = palloc_get_page (PAL_USER);
-		if (kpage == NULL)
-			return false;
+		if (kpage == NULL) {
+			success = false;
+			break;
+		}
+		kpages[cnt++] = kpage;
 
 		/* Load this page. */
 		if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes) {
-			palloc_free_page (kpage);
-			return false;
+			success = false;
+			break;
 		}
 		memset (kpage + page_read_bytes, 0, page_zero_bytes);
 
-		/* Add the page to the process's address space. */
-		if (!install_page (upage, kpage, writable)) {
-			printf("fail\n");
-			palloc_free_page (kpage);
-			return false;
-		}
-
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
+
+		/* Add the batch to the process's address space. */
+		if (cnt == max_cnt || (read_bytes == 0 && zero_bytes == 0)) {
+			if (!install_pages (upage, kpages, cnt, writable)) {
+				success = false;
+				break;
+			}
+			upage += cnt * PGSIZE;
+			cnt = 0;
+		}
 	}
-	return true;
+	if (!success)
+		while (cnt > 0)
+			palloc_free_page (kpages[--cnt]);
+	palloc_free_page (kpages);
+	return success;
 }
 
 /* Create a minimal stack by mapping a zeroed page at the USER_STACK */
@@ -569,16 +1105,46 @@ install_page (void *upage, void *kpage, bool writable) {
 	return (pml4_get_page (t->pml4, upage) == NULL
 			&& pml4_set_page (t->pml4, upage, kpage, writable));
 }
+
+/* Maps the CNT pages from user virtual address UPAGE to the kernel
+ * virtual addresses in KPAGES, like install_page() for each of them.
+ * On failure, the pages that did get mapped are unmapped again, so
+ * that all of KPAGES are still the caller's to free. */
+static bool
+install_pages (void *upage, void **kpages, size_t cnt, bool writable) {
+	struct thread *t = thread_current ();
+	void *end = (uint8_t *) upage + cnt * PGSIZE;
+	size_t i;
+
+	if (pml4_map_range (t->pml4, upage, end, kpages, writable))
+		return true;
+	for (i = 0; i < cnt; i++) {
+		void *va = (uint8_t *) upage + i * PGSIZE;
+		if (pml4_get_page (t->pml4, va) == kpages[i])
+			pml4_clear_page (t->pml4, va);
+	}
+	return false;
+}
 #else
 /* From here, codes will be used after project 3.
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Fills a page of an ELF segment area on its first fault: the part
+ * that lies in the file is read, the rest is zeroed.  AUX is the
+ * segment's area. */
 static bool
 lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+	struct vm_area *area = aux;
+	void *kva = page->frame->kva;
+	off_t ofs;
+	size_t page_read_bytes = vm_area_read_bytes (area, page->va, &ofs);
+
+	if (file_read_at (area->file, kva, page_read_bytes, ofs)
+			!= (off_t) page_read_bytes)
+		return false;
+	memset ((uint8_t *) kva + page_read_bytes, 0, PGSIZE - page_read_bytes);
+	return true;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -593,6 +1159,12 @@ lazy_load_segment (struct page *page, void *aux) {
  * The pages initialized by this function must be writable by the
  * user process if WRITABLE is true, read-only otherwise.
  *
+ * The whole segment becomes one area; its pages are only created
+ * and read when they are first touched.  A read-only segment maps
+ * its file, so that every process running the same program shares
+ * the text through the page cache; a writable one is anonymous
+ * memory filled from the file.
+ *
  * Return true if successful, false if a memory allocation error
  * or disk read error occurs. */
 static bool
@@ -602,25 +1174,11 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
-	while (read_bytes > 0 || zero_bytes > 0) {
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
-
-		/* Advance. */
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
-	}
-	return true;
+	return vm_area_add (&thread_current ()->spt, upage,
+			upage + read_bytes + zero_bytes,
+			!writable && read_bytes > 0 ? VM_FILE : VM_ANON, writable,
+			lazy_load_segment, read_bytes > 0 ? file : NULL, ofs,
+			read_bytes) != NULL;
 }
 
 /* Create a PAGE of stack at the USER_STACK. Return true on success. */
@@ -628,11 +1186,15 @@ static bool
 setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
-
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
+	/* The stack is an area of its own, with its first page claimed
+	 * right away. */
+	if (vm_area_add (&thread_current ()->spt, stack_bottom,
+				(void *) USER_STACK, VM_ANON | VM_STACK, true, NULL, NULL, 0,
+				0) == NULL)
+		return false;
+	success = vm_claim_page (stack_bottom);
+	if (success)
+		if_->rsp = USER_STACK;
 
 	return success;
 }
@@ -1,15 +1,35 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/loader.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "threads/init.h"
 #include "userprog/gdt.h"
+#include "userprog/fdtable.h"
+#include "userprog/process.h"
 #include "threads/flags.h"
+#include "devices/input.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
 #include "intrinsic.h"
+#include <spawn.h>
+#ifdef VM
+#include <mman.h>
+#include "vm/fault.h"
+#include "vm/file.h"
+#include "vm/rss.h"
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
+static void sys_exit (int status) NO_RETURN;
 
 /* System call.
  *
@@ -24,8 +44,12 @@ void syscall_handler (struct intr_frame *);
 #define MSR_LSTAR 0xc0000082        /* Long mode SYSCALL target */
 #define MSR_SYSCALL_MASK 0xc0000084 /* Mask for the eflags */
 
+struct lock filesys_lock;
+
 void
 syscall_init (void) {
+	lock_init (&filesys_lock);
+
 	write_msr(MSR_STAR, ((uint64_t)SEL_UCSEG - 0x10) << 48  |
 			((uint64_t)SEL_KCSEG) << 32);
 	write_msr(MSR_LSTAR, (uint64_t) syscall_entry);
@@ -37,9 +61,494 @@ syscall_init (void) {
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
 }
 
+/* Returns whether the SIZE bytes at user address UADDR may be
+ * accessed on behalf of the current process, written to if WRITE is
+ * true. */
+static bool
+user_access_ok (const void *uaddr, size_t size, bool write) {
+#ifdef VM
+	return vm_user_range_ok (uaddr, size, write);
+#else
+	const uint8_t *p = pg_round_down (uaddr);
+	const uint8_t *end = (const uint8_t *) uaddr + size;
+
+	if (end < (const uint8_t *) uaddr
+			|| (size > 0 && !is_user_vaddr (end - 1)))
+		return false;
+	for (; p < end; p += PGSIZE) {
+		uint64_t *pte = pml4e_walk (thread_current ()->pml4, (uint64_t) p, 0);
+
+		if (pte == NULL || !(*pte & PTE_P) || (write && !is_writable (pte)))
+			return false;
+	}
+	return true;
+#endif
+}
+
+/* Returns whether the SIZE bytes at user address UADDR may be read. */
+static bool
+user_readable (const void *uaddr, size_t size) {
+	return user_access_ok (uaddr, size, false);
+}
+
+/* Appends the user string USTR to the command line CMD_LINE, a page
+ * that holds *LEN bytes, separated by a space unless it is the first.
+ * Returns false if USTR cannot be read or does not fit. */
+static bool
+append_user_string (char *cmd_line, size_t *len, const char *ustr) {
+	const char *start = ustr;
+	size_t i = *len;
+
+	if (i > 0)
+		cmd_line[i++] = ' ';
+	for (;; ustr++) {
+		if (i >= PGSIZE)
+			return false;
+		if ((ustr == start || pg_ofs (ustr) == 0)
+				&& !user_readable (ustr, 1))
+			return false;
+		if ((cmd_line[i] = *ustr) == '\0')
+			break;
+		i++;
+	}
+	*len = i;
+	return true;
+}
+
+/* Terminates the current process with exit status STATUS. */
+static void
+sys_exit (int status) {
+	thread_current ()->exit_status = status;
+	thread_exit ();
+}
+
+/* Returns a copy of the user string USTR in a new page, or a null
+ * pointer if it does not fit or memory is short.  A USTR that cannot
+ * be read kills the process. */
+static char *
+copy_in_string (const char *ustr) {
+	char *kstr = palloc_get_page (0);
+	size_t i;
+
+	if (kstr == NULL)
+		return NULL;
+	for (i = 0; i < PGSIZE; i++) {
+		if ((i == 0 || pg_ofs (ustr + i) == 0)
+				&& !user_readable (ustr + i, 1)) {
+			palloc_free_page (kstr);
+			sys_exit (-1);
+		}
+		if ((kstr[i] = ustr[i]) == '\0')
+			return kstr;
+	}
+	palloc_free_page (kstr);
+	return NULL;
+}
+
+/* Builds the command line of spawn(PATH, ARGV) in a new page: PATH,
+ * then ARGV[1] onward up to a null pointer.  ARGV[0] names the program
+ * to itself, which the command line does with PATH already.  Returns
+ * a null pointer if the strings cannot be read or do not fit. */
+static char *
+spawn_cmd_line (const char *path, char *const argv[]) {
+	char *cmd_line = palloc_get_page (0);
+	size_t len = 0;
+
+	if (cmd_line == NULL)
+		return NULL;
+	if (!append_user_string (cmd_line, &len, path))
+		goto fail;
+	if (argv != NULL)
+		for (argv++;; argv++) {
+			if (!user_readable (argv, sizeof *argv))
+				goto fail;
+			if (*argv == NULL)
+				break;
+			if (!append_user_string (cmd_line, &len, *argv))
+				goto fail;
+		}
+	return cmd_line;
+
+fail:
+	palloc_free_page (cmd_line);
+	return NULL;
+}
+
+/* Opens the file named by the user string PATH as descriptor FD of
+ * FDS, closing FD first if it was open.  Returns false if PATH cannot
+ * be read or opened. */
+static bool
+spawn_open (struct fd_table *fds, int fd, const char *path) {
+	char *name = palloc_get_page (0);
+	struct file *file = NULL;
+	size_t len = 0;
+	int tmp;
+
+	if (name != NULL && append_user_string (name, &len, path)) {
+		lock_acquire (&filesys_lock);
+		file = filesys_open (name);
+		lock_release (&filesys_lock);
+	}
+	palloc_free_page (name);
+	if (file == NULL)
+		return false;
+
+	lock_acquire (&filesys_lock);
+	tmp = fd_install (fds, file);
+	if (tmp >= 0 && tmp != fd) {
+		if (fd_dup2 (fds, tmp, fd) < 0)
+			fd = -1;
+		fd_close (fds, tmp);
+	}
+	lock_release (&filesys_lock);
+	return tmp >= 0 && fd >= 0;
+}
+
+/* Carries out the ACTION_CNT file descriptor ACTIONS, which lie in
+ * user memory, in order on FDS, the descriptors of a process about to
+ * be spawned.  The parent does this, so that paths are read from its
+ * memory and a failure fails the spawn().  Returns false if an action
+ * fails. */
+static bool
+do_spawn_actions (struct fd_table *fds, const struct spawn_action *actions,
+		size_t action_cnt) {
+	size_t i;
+
+	for (i = 0; i < action_cnt; i++) {
+		struct spawn_action a = actions[i];
+		bool ok = false;
+
+		switch (a.type) {
+			case SPAWN_CLOSE:
+				lock_acquire (&filesys_lock);
+				ok = fd_close (fds, a.fd);
+				lock_release (&filesys_lock);
+				break;
+			case SPAWN_DUP2:
+				lock_acquire (&filesys_lock);
+				ok = fd_dup2 (fds, a.fd, a.newfd) >= 0;
+				lock_release (&filesys_lock);
+				break;
+			case SPAWN_OPEN:
+				ok = spawn_open (fds, a.fd, a.path);
+				break;
+		}
+		if (!ok)
+			return false;
+	}
+	return true;
+}
+
+/* The spawn() system call.  The child starts with a copy of the
+ * current process's descriptors, changed by ACTIONS. */
+static tid_t
+sys_spawn (const char *path, char *const argv[],
+		const struct spawn_action *actions, size_t action_cnt) {
+	struct fd_table *fds;
+	char *cmd_line;
+
+	if (action_cnt > SPAWN_ACTIONS_MAX
+			|| !user_readable (actions, action_cnt * sizeof *actions))
+		return TID_ERROR;
+	cmd_line = spawn_cmd_line (path, argv);
+	if (cmd_line == NULL)
+		return TID_ERROR;
+
+	lock_acquire (&filesys_lock);
+	fds = fd_table_duplicate (thread_current ()->fds);
+	lock_release (&filesys_lock);
+	if (fds == NULL || !do_spawn_actions (fds, actions, action_cnt)) {
+		lock_acquire (&filesys_lock);
+		fd_table_destroy (fds);
+		lock_release (&filesys_lock);
+		palloc_free_page (cmd_line);
+		return TID_ERROR;
+	}
+	return process_spawn (cmd_line, fds);
+}
+
+/* The fork() system call, from the user context F. */
+static tid_t
+sys_fork (const char *thread_name, struct intr_frame *f) {
+	char *name = copy_in_string (thread_name);
+	tid_t tid;
+
+	if (name == NULL)
+		return TID_ERROR;
+	tid = process_fork (name, f);
+	palloc_free_page (name);
+	return tid;
+}
+
+/* The exec() system call.  Returns only if FILE does not fit in a
+ * page; once the current program is gone, a failure to load the new
+ * one ends the process. */
+static int
+sys_exec (const char *file) {
+	char *cmd_line = copy_in_string (file);
+
+	if (cmd_line == NULL)
+		return -1;
+	process_exec (cmd_line);
+	sys_exit (-1);
+}
+
+/* The create() system call. */
+static bool
+sys_create (const char *file, unsigned initial_size) {
+	char *name = copy_in_string (file);
+	bool success;
+
+	if (name == NULL)
+		return false;
+	lock_acquire (&filesys_lock);
+	success = filesys_create (name, initial_size);
+	lock_release (&filesys_lock);
+	palloc_free_page (name);
+	return success;
+}
+
+/* The remove() system call. */
+static bool
+sys_remove (const char *file) {
+	char *name = copy_in_string (file);
+	bool success;
+
+	if (name == NULL)
+		return false;
+	lock_acquire (&filesys_lock);
+	success = filesys_remove (name);
+	lock_release (&filesys_lock);
+	palloc_free_page (name);
+	return success;
+}
+
+/* The open() system call. */
+static int
+sys_open (const char *file) {
+	char *name = copy_in_string (file);
+	struct file *f;
+	int fd = -1;
+
+	if (name == NULL)
+		return -1;
+	lock_acquire (&filesys_lock);
+	f = filesys_open (name);
+	if (f != NULL)
+		fd = fd_install (thread_current ()->fds, f);
+	lock_release (&filesys_lock);
+	palloc_free_page (name);
+	return fd;
+}
+
+/* The filesize() system call. */
+static int
+sys_filesize (int fd) {
+	struct file *file = fd_file (thread_current ()->fds, fd);
+	int size;
+
+	if (file == NULL)
+		return -1;
+	lock_acquire (&filesys_lock);
+	size = file_length (file);
+	lock_release (&filesys_lock);
+	return size;
+}
+
+/* The read() system call. */
+static int
+sys_read (int fd, void *buffer, unsigned size) {
+	struct open_file *of = fd_lookup (thread_current ()->fds, fd);
+	int bytes_read;
+
+	if (!user_access_ok (buffer, size, true))
+		sys_exit (-1);
+	if (of == NULL)
+		return -1;
+	if (of->file == NULL) {
+		unsigned i;
+
+		if (of->console != STDIN_FILENO)
+			return -1;
+		for (i = 0; i < size; i++)
+			((uint8_t *) buffer)[i] = input_getc ();
+		return size;
+	}
+	lock_acquire (&filesys_lock);
+	bytes_read = file_read (of->file, buffer, size);
+	lock_release (&filesys_lock);
+	return bytes_read;
+}
+
+/* The write() system call. */
+static int
+sys_write (int fd, const void *buffer, unsigned size) {
+	struct open_file *of = fd_lookup (thread_current ()->fds, fd);
+	int bytes_written;
+
+	if (!user_readable (buffer, size))
+		sys_exit (-1);
+	if (of == NULL)
+		return -1;
+	if (of->file == NULL) {
+		if (of->console != STDOUT_FILENO)
+			return -1;
+		putbuf (buffer, size);
+		return size;
+	}
+	lock_acquire (&filesys_lock);
+	bytes_written = file_write (of->file, buffer, size);
+	lock_release (&filesys_lock);
+	return bytes_written;
+}
+
+/* The seek() system call. */
+static void
+sys_seek (int fd, unsigned position) {
+	struct file *file = fd_file (thread_current ()->fds, fd);
+
+	if (file != NULL)
+		file_seek (file, position);
+}
+
+/* The tell() system call. */
+static unsigned
+sys_tell (int fd) {
+	struct file *file = fd_file (thread_current ()->fds, fd);
+
+	return file != NULL ? (unsigned) file_tell (file) : (unsigned) -1;
+}
+
+/* The close() system call. */
+static void
+sys_close (int fd) {
+	lock_acquire (&filesys_lock);
+	fd_close (thread_current ()->fds, fd);
+	lock_release (&filesys_lock);
+}
+
+/* The dup2() system call. */
+static int
+sys_dup2 (int oldfd, int newfd) {
+	int fd;
+
+	lock_acquire (&filesys_lock);
+	fd = fd_dup2 (thread_current ()->fds, oldfd, newfd);
+	lock_release (&filesys_lock);
+	return fd;
+}
+
+#ifdef VM
+/* The mmap() system call.  WRITABLE may carry mmap() flags; an
+ * anonymous mapping ignores FD. */
+static void *
+sys_mmap (void *addr, size_t length, int writable, int fd, off_t offset) {
+	struct file *file = NULL;
+	void *mapping = MAP_FAILED;
+
+	lock_acquire (&filesys_lock);
+	if (!(writable & MAP_ANONYMOUS)) {
+		/* The console cannot be mapped. */
+		file = fd_file (thread_current ()->fds, fd);
+		if (file == NULL)
+			goto done;
+	}
+	mapping = do_mmap (addr, length, writable, file, offset);
+done:
+	lock_release (&filesys_lock);
+	return mapping;
+}
+#endif
+
 /* The main system call interface */
 void
-syscall_handler (struct intr_frame *f UNUSED) {
+syscall_handler (struct intr_frame *f) {
+#ifdef VM
+	/* Kernel page faults on user memory check stack growth against
+	 * this, as F is not at hand then. */
+	thread_current ()->user_rsp = f->rsp;
+#endif
+	switch (f->R.rax) {
+		case SYS_HALT:
+			power_off ();
+		case SYS_EXIT:
+			sys_exit (f->R.rdi);
+		case SYS_FORK:
+			f->R.rax = sys_fork ((const char *) f->R.rdi, f);
+			return;
+		case SYS_EXEC:
+			f->R.rax = sys_exec ((const char *) f->R.rdi);
+			return;
+		case SYS_WAIT:
+			f->R.rax = process_wait (f->R.rdi);
+			return;
+		case SYS_CREATE:
+			f->R.rax = sys_create ((const char *) f->R.rdi, f->R.rsi);
+			return;
+		case SYS_REMOVE:
+			f->R.rax = sys_remove ((const char *) f->R.rdi);
+			return;
+		case SYS_OPEN:
+			f->R.rax = sys_open ((const char *) f->R.rdi);
+			return;
+		case SYS_FILESIZE:
+			f->R.rax = sys_filesize (f->R.rdi);
+			return;
+		case SYS_READ:
+			f->R.rax = sys_read (f->R.rdi, (void *) f->R.rsi, f->R.rdx);
+			return;
+		case SYS_WRITE:
+			f->R.rax = sys_write (f->R.rdi, (const void *) f->R.rsi,
+					f->R.rdx);
+			return;
+		case SYS_SEEK:
+			sys_seek (f->R.rdi, f->R.rsi);
+			return;
+		case SYS_TELL:
+			f->R.rax = sys_tell (f->R.rdi);
+			return;
+		case SYS_CLOSE:
+			sys_close (f->R.rdi);
+			return;
+		case SYS_DUP2:
+			f->R.rax = sys_dup2 (f->R.rdi, f->R.rsi);
+			return;
+		case SYS_SPAWN:
+			f->R.rax = sys_spawn ((const char *) f->R.rdi,
+					(char *const *) f->R.rsi,
+					(const struct spawn_action *) f->R.rdx, f->R.r10);
+			return;
+		case SYS_VFORK:
+			f->R.rax = process_vfork (thread_name (), f);
+			return;
+#ifdef VM
+		case SYS_RSS_LIMIT:
+			f->R.rax = rss_set_limit (f->R.rdi, f->R.rsi);
+			return;
+		case SYS_MADVISE:
+			f->R.rax = vm_madvise ((void *) f->R.rdi, f->R.rsi, f->R.rdx);
+			return;
+		case SYS_FAULT_STATS:
+			f->R.rax = fault_get_stats ((struct fault_stats *) f->R.rdi);
+			return;
+		case SYS_SBRK:
+			f->R.rax = (uint64_t) vm_sbrk (f->R.rdi);
+			return;
+		case SYS_MMAP:
+			f->R.rax = (uint64_t) sys_mmap ((void *) f->R.rdi, f->R.rsi,
+					f->R.rdx, f->R.r10, f->R.r8);
+			return;
+		case SYS_MUNMAP:
+			do_munmap ((void *) f->R.rdi);
+			return;
+		case SYS_STACK_LIMIT:
+			f->R.rax = vm_set_stack_limit (f->R.rdi);
+			return;
+		case SYS_MSYNC:
+			f->R.rax = vm_msync ((void *) f->R.rdi, f->R.rsi, f->R.rdx);
+			return;
+#endif
+	}
 	// TODO: Your implementation goes here.
 	printf ("system call!\n");
 	thread_exit ();
@@ -1,4 +1,6 @@
 userprog_SRC  = userprog/process.c	# Process loading.
+userprog_SRC += userprog/exec_cache.c	# Cache of parsed executables.
+userprog_SRC += userprog/fdtable.c	# File descriptor tables.
 userprog_SRC += userprog/exception.c	# User exception handler.
 userprog_SRC += userprog/syscall-entry.S # System call entry.
 userprog_SRC += userprog/syscall.c	# System call handler.
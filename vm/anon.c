@@ -1,7 +1,38 @@
-/* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
+/* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page).
+ *
+ * Evicted anonymous pages go first to the compressed pool of
+ * zswap.c.  Pages that do not compress, and the oldest pages of the
+ * pool once it is full, go to the swap disk, hd1:1, which is divided
+ * into page-sized slots.  Swap I/O is organized around clusters:
+ *
+ *   - Pages evicted together are sorted by area and address and get
+ *     adjacent slots, found by a next-fit search, so a whole cluster
+ *     goes out as one multi-sector write.
+ *
+ *   - Swapping a page in also reads the slots that follow it as long
+ *     as they hold swapped-out pages of the same area, which were
+ *     likely evicted along with it and will likely be wanted next.
+ *
+ * A frame shared copy-on-write is evicted once for all of its pages,
+ * which then share one slot, counted in SLOT_REFS; each page swapped
+ * back in gets a private copy, and the last one frees the slot.  Such
+ * frames skip zswap, whose entries belong to a single page.
+ *
+ * A page that holds nothing but zeros goes nowhere: evicted with no
+ * copy in zswap or on disk, it reads back as zeros, and vm.c maps the
+ * shared zero page for it until it is written. */
 
+#include <bitmap.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "vm/frame.h"
 #include "vm/vm.h"
+#include "vm/zswap.h"
 #include "devices/disk.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +48,516 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Sectors per swap slot. */
+#define SLOT_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Most slots transferred in one disk burst. */
+#define BURST_SLOTS (DISK_BURST_MAX / SLOT_SECTORS)
+
+/* Most pages read by one swap-in, the faulting page included. */
+#define SWAP_READAHEAD 8
+
+/* Pages moved from the compressed pool to disk at a time. */
+#define ZSWAP_WRITEBACK 8
+
+static struct lock swap_lock;       /* Protects the swap state below. */
+static size_t slot_cnt;             /* Slots on the swap disk. */
+static struct bitmap *used_map;     /* Allocated slots. */
+static struct page **slot_pages;    /* Page in each allocated slot, or
+                                       NULL if several share it. */
+static int *slot_refs;              /* Pages sharing each slot. */
+static size_t next_fit;             /* Where slot searches begin. */
+static void *burst[DISK_BURST_MAX]; /* Sector buffers of one burst. */
+static void *bounce[ZSWAP_WRITEBACK];  /* Decompressed pool pages. */
+
+/* Statistics. */
+static long long out_cnt;           /* Pages written to swap. */
+static long long out_burst_cnt;     /* Bursts they were written in. */
+static long long in_cnt;            /* Pages read from swap. */
+static long long readahead_cnt;     /* ...of which were read ahead. */
+static long long writeback_cnt;     /* Pages moved from zswap to disk. */
+static long long zero_out_cnt;      /* Pages of zeros evicted. */
+static long long zero_in_cnt;       /* ...and given a frame again. */
+
+/* A page on its way to swap. */
+struct swap_out {
+	const struct vm_area *area;   /* Area and address of the page, which */
+	const void *va;               /*   decide where it goes on disk. */
+	void *kva;                    /* Its contents. */
+	size_t slot;                  /* Slot given by swap_write(). */
+	void *aux;                    /* The caller's. */
+};
+
+static void swap_io (size_t slot, size_t cnt, void *kvas[], bool write);
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	size_t map_pages, i;
+
+	swap_disk = disk_get (1, 1);
+	lock_init (&swap_lock);
+	zswap_init ();
+	if (swap_disk == NULL)
+		return;
+
+	slot_cnt = disk_size (swap_disk) / SLOT_SECTORS;
+	map_pages = DIV_ROUND_UP (slot_cnt * sizeof *slot_pages, PGSIZE);
+	used_map = bitmap_create (slot_cnt);
+	slot_pages = palloc_get_multiple (PAL_ZERO, map_pages);
+	slot_refs = palloc_get_multiple (PAL_ZERO,
+			DIV_ROUND_UP (slot_cnt * sizeof *slot_refs, PGSIZE));
+	if (used_map == NULL || slot_pages == NULL || slot_refs == NULL)
+		PANIC ("vm_anon_init: out of memory for %zu swap slots", slot_cnt);
+	for (i = 0; i < ZSWAP_WRITEBACK; i++)
+		if ((bounce[i] = palloc_get_page (0)) == NULL)
+			PANIC ("vm_anon_init: out of memory");
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = SWAP_NONE;
+	anon_page->zentry = NULL;
+	anon_page->lazy_free = false;
+	return true;
+}
+
+/* Allocates CNT slots and returns the first, preferring the first
+ * run of free slots at or after NEXT_FIT.  Returns BITMAP_ERROR if
+ * there is no such run.  The caller must hold SWAP_LOCK. */
+static size_t
+slot_alloc (size_t cnt) {
+	size_t slot = bitmap_scan_and_flip (used_map, next_fit, cnt, false);
+
+	if (slot == BITMAP_ERROR)
+		slot = bitmap_scan_and_flip (used_map, 0, cnt, false);
+	if (slot != BITMAP_ERROR)
+		next_fit = slot + cnt < slot_cnt ? slot + cnt : 0;
+	return slot;
+}
+
+/* Frees SLOT.  The caller must hold SWAP_LOCK. */
+static void
+slot_free (size_t slot) {
+	ASSERT (bitmap_test (used_map, slot));
+
+	bitmap_reset (used_map, slot);
+	slot_pages[slot] = NULL;
+	slot_refs[slot] = 0;
+}
+
+/* Drops one page's reference to SLOT, freeing it with the last.  The
+ * caller must hold SWAP_LOCK. */
+static void
+slot_put (size_t slot) {
+	ASSERT (slot_refs[slot] > 0);
+
+	if (--slot_refs[slot] == 0)
+		slot_free (slot);
+}
+
+/* Orders pages by area, then by address, so that neighbours in the
+ * address space become neighbours on disk. */
+static bool
+out_before (const struct swap_out *a, const struct swap_out *b) {
+	if (a->area != b->area)
+		return a->area < b->area;
+	return a->va < b->va;
+}
+
+/* Writes the CNT pages of OUTS to swap in as few bursts as possible,
+ * storing the slot of each into its SLOT.  OUTS is sorted along the
+ * way.  Returns false, writing
+ * nothing, if swap does not have room for all of them.  The caller
+ * must hold SWAP_LOCK. */
+static bool
+swap_write (struct swap_out outs[], size_t cnt) {
+	static void *kvas[SWAP_CLUSTER];    /* Under SWAP_LOCK. */
+	size_t i, j;
+
+	ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+	if (swap_disk == NULL)
+		return false;
+
+	for (i = 1; i < cnt; i++)
+		for (j = i; j > 0 && out_before (&outs[j], &outs[j - 1]); j--) {
+			struct swap_out tmp = outs[j];
+			outs[j] = outs[j - 1];
+			outs[j - 1] = tmp;
+		}
+
+	/* One extent if possible, else whatever single slots are left. */
+	outs[0].slot = slot_alloc (cnt);
+	if (outs[0].slot != BITMAP_ERROR) {
+		for (i = 1; i < cnt; i++)
+			outs[i].slot = outs[0].slot + i;
+	} else {
+		for (i = 0; i < cnt; i++)
+			if ((outs[i].slot = slot_alloc (1)) == BITMAP_ERROR) {
+				while (i-- > 0)
+					slot_free (outs[i].slot);
+				return false;
+			}
+	}
+
+	/* Write each run of adjacent slots in one burst. */
+	for (i = 0; i < cnt; i++)
+		kvas[i] = outs[i].kva;
+	for (i = 0; i < cnt; i = j) {
+		for (j = i + 1; j < cnt && j - i < BURST_SLOTS
+				&& outs[j].slot == outs[i].slot + (j - i); j++)
+			continue;
+		swap_io (outs[i].slot, j - i, kvas + i, true);
+		out_burst_cnt++;
+	}
+	out_cnt += cnt;
+	return true;
+}
+
+/* Moves the oldest pages of the compressed pool to disk.  Returns
+ * false if there were none or the disk is full.  The caller must hold
+ * SWAP_LOCK. */
+static bool
+zswap_writeback (void) {
+	static struct zswap_entry *entries[ZSWAP_WRITEBACK];
+	static struct swap_out outs[ZSWAP_WRITEBACK];
+	size_t cnt = zswap_oldest (entries, ZSWAP_WRITEBACK), i;
+
+	if (cnt == 0 || swap_disk == NULL)
+		return false;
+	for (i = 0; i < cnt; i++) {
+		struct page *page = zswap_page (entries[i]);
+
+		outs[i] = (struct swap_out) {
+			.area = page->area,
+			.va = page->va,
+			.kva = bounce[i],
+			.aux = entries[i],
+		};
+		zswap_load (entries[i], outs[i].kva);
+	}
+	if (!swap_write (outs, cnt))
+		return false;
+	for (i = 0; i < cnt; i++) {
+		struct zswap_entry *entry = outs[i].aux;
+		struct page *page = zswap_page (entry);
+
+		page->anon.zentry = NULL;
+		page->anon.slot = outs[i].slot;
+		slot_pages[outs[i].slot] = page;
+		slot_refs[outs[i].slot] = 1;
+		zswap_free (entry);
+	}
+	writeback_cnt += cnt;
+	return true;
+}
+
+/* Returns true if the page at KVA holds only zeros.  The kernel does
+ * not use SSE, so this reads 64 bytes per step as eight words, which
+ * the compiler can keep in registers, and stops at the first step
+ * that finds a nonzero bit. */
+static bool
+page_is_zero (const void *kva) {
+	const uint64_t *p = kva, *end = p + PGSIZE / sizeof *p;
+
+	for (; p < end; p += 8)
+		if ((p[0] | p[1] | p[2] | p[3] | p[4] | p[5] | p[6] | p[7]) != 0)
+			return false;
+	return true;
+}
+
+/* Returns true if PAGE, which has no frame, would read back as zeros:
+ * it was evicted as a page of zeros or dropped, and no copy of it is
+ * in zswap or on disk. */
+bool
+anon_is_zero (struct page *page) {
+	struct anon_page *anon_page = &page->anon;
+	bool zero;
+
+	lock_acquire (&swap_lock);
+	zero = anon_page->slot == SWAP_NONE && anon_page->zentry == NULL;
+	lock_release (&swap_lock);
+	return zero;
+}
+
+/* Sets up EV for the eviction of FRAME, an anonymous frame whose
+ * pages are unmapped.  The caller must hold the frame table lock. */
+void
+anon_evict_init (struct anon_evict *ev, struct frame *frame) {
+	*ev = (struct anon_evict) {
+		.frame = frame,
+		.kva = frame->kva,
+		.area = frame->page->area,
+		.va = frame->page->va,
+		.shared = frame->map_cnt > 1,
+		.slot = SWAP_NONE,
+	};
+}
+
+/* Copies the contents of the CNT frames of EVICTS, set up by
+ * anon_evict_init(), out of RAM.  Pages of zeros need no copy; a frame
+ * of a single page goes to zswap if it compresses and the pool has
+ * room; the rest goes to disk.  The frame table lock need not be
+ * held, and should not be, across the disk writes; nothing here looks
+ * at the frames themselves.  EVICTS may be reordered.  Returns false,
+ * copying none of them, if there is no room for all of them. */
+bool
+anon_swap_out_cluster (struct anon_evict evicts[], size_t cnt) {
+	static struct swap_out outs[SWAP_CLUSTER];  /* Under SWAP_LOCK. */
+	size_t out_cnt = 0, i;
+	bool ok = true;
+
+	ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+	lock_acquire (&swap_lock);
+	while (zswap_full () && zswap_writeback ())
+		continue;
+
+	for (i = 0; i < cnt; i++) {
+		struct anon_evict *ev = &evicts[i];
+
+		if (page_is_zero (ev->kva)) {
+			zero_out_cnt++;
+			continue;
+		}
+		if (!ev->shared && !zswap_full ()
+				&& (ev->zentry = zswap_store (ev->kva)) != NULL)
+			continue;
+		outs[out_cnt++] = (struct swap_out) {
+			.area = ev->area,
+			.va = ev->va,
+			.kva = ev->kva,
+			.aux = ev,
+		};
+	}
+	if (out_cnt > 0 && !swap_write (outs, out_cnt)) {
+		for (i = 0; i < cnt; i++)
+			if (evicts[i].zentry != NULL) {
+				zswap_free (evicts[i].zentry);
+				evicts[i].zentry = NULL;
+			}
+		ok = false;
+	} else
+		for (i = 0; i < out_cnt; i++)
+			((struct anon_evict *) outs[i].aux)->slot = outs[i].slot;
+	lock_release (&swap_lock);
+	return ok;
+}
+
+/* Gives the copy made by anon_swap_out_cluster() for EV to the pages
+ * still in its frame, which share a swap slot if there are several of
+ * them.  If none is left, the copy is freed.  The caller must hold the
+ * frame table lock. */
+void
+anon_evict_attach (struct anon_evict *ev) {
+	struct frame *frame = ev->frame;
+	struct list_elem *e;
+
+	if (frame->map_cnt == 0) {
+		anon_evict_cancel (ev);
+		return;
+	}
+	lock_acquire (&swap_lock);
+	if (ev->zentry != NULL) {
+		/* Only unshared frames go to zswap, and no page joins a frame
+		 * under eviction. */
+		ASSERT (frame->map_cnt == 1);
+		frame->page->anon.zentry = ev->zentry;
+		zswap_attach (ev->zentry, frame->page);
+	} else if (ev->slot != SWAP_NONE) {
+		slot_pages[ev->slot] = frame->map_cnt == 1 ? frame->page : NULL;
+		slot_refs[ev->slot] = frame->map_cnt;
+		for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+				e = list_next (e))
+			list_entry (e, struct page, frame_elem)->anon.slot = ev->slot;
+	}
+	lock_release (&swap_lock);
+}
+
+/* Frees the copy made by anon_swap_out_cluster() for EV, whose frame
+ * stays. */
+void
+anon_evict_cancel (struct anon_evict *ev) {
+	lock_acquire (&swap_lock);
+	if (ev->zentry != NULL)
+		zswap_free (ev->zentry);
+	if (ev->slot != SWAP_NONE)
+		slot_free (ev->slot);
+	ev->zentry = NULL;
+	ev->slot = SWAP_NONE;
+	lock_release (&swap_lock);
+}
+
+/* Gives back read-ahead frames FRAMES[FIRST] to FRAMES[LAST]. */
+static void
+readahead_release (struct frame *frames[], size_t first, size_t last) {
+	for (; first <= last; first++)
+		vm_readahead_release (frames[first]);
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	struct page *pages[SWAP_READAHEAD];
+	struct frame *frames[SWAP_READAHEAD];
+	void *kvas[SWAP_READAHEAD];
+	size_t frame_cnt = 0, slot, cnt, i;
+
+	/* Frames to read ahead into come from the frame allocator, which
+	 * must not run under SWAP_LOCK, so take them first: FRAMES[1] to
+	 * FRAMES[FRAME_CNT].  Whether the page is on disk at all is only a
+	 * hint here; it is checked again under the lock. */
+	if (anon_page->zentry == NULL && anon_page->slot != SWAP_NONE
+			&& page->area != NULL)
+		while (frame_cnt + 1 < SWAP_READAHEAD
+				&& (frames[frame_cnt + 1] = vm_readahead_frame ()) != NULL)
+			frame_cnt++;
+
+	lock_acquire (&swap_lock);
+	slot = anon_page->slot;
+	if (anon_page->zentry != NULL) {
+		zswap_load (anon_page->zentry, kva);
+		zswap_free (anon_page->zentry);
+		anon_page->zentry = NULL;
+		lock_release (&swap_lock);
+		readahead_release (frames, 1, frame_cnt);
+		return true;
+	}
+	if (slot == SWAP_NONE) {
+		zero_in_cnt++;
+		lock_release (&swap_lock);
+		readahead_release (frames, 1, frame_cnt);
+		memset (kva, 0, PGSIZE);
+		return true;
+	}
+
+	pages[0] = page;
+	kvas[0] = kva;
+	for (cnt = 1; cnt <= frame_cnt && slot + cnt < slot_cnt; cnt++) {
+		struct page *next = slot_pages[slot + cnt];
+
+		if (next == NULL || next->area != page->area)
+			break;
+		pages[cnt] = next;
+		kvas[cnt] = frames[cnt]->kva;
+	}
+	swap_io (slot, cnt, kvas, false);
+	slot_put (slot);
+	anon_page->slot = SWAP_NONE;
+	in_cnt += cnt;
+	lock_release (&swap_lock);
+	readahead_release (frames, cnt, frame_cnt);
+
+	/* Map the pages read ahead.  One that cannot be mapped simply
+	 * stays in swap. */
+	for (i = 1; i < cnt; i++) {
+		if (!vm_install_page (pages[i], frames[i]))
+			continue;
+		lock_acquire (&swap_lock);
+		slot_put (slot + i);
+		pages[i]->anon.slot = SWAP_NONE;
+		readahead_cnt++;
+		lock_release (&swap_lock);
+	}
+	return true;
 }
 
-/* Swap out the page by writing contents to the swap disk. */
+/* Makes PAGE, a new anonymous page with no frame, share the copy of
+ * SRC, an evicted anonymous page, so that a fork does not have to
+ * bring SRC back in.  A page of zeros needs no copy at all.  Returns
+ * false if SRC's copy is in zswap, whose entries cannot be shared. */
+bool
+anon_share (struct page *page, struct page *src) {
+	size_t slot = src->anon.slot;
+	bool ok;
+
+	lock_acquire (&swap_lock);
+	ok = src->anon.zentry == NULL;
+	if (ok && slot != SWAP_NONE) {
+		page->anon.slot = slot;
+		slot_pages[slot] = NULL;
+		slot_refs[slot]++;
+	}
+	lock_release (&swap_lock);
+	return ok;
+}
+
+/* Swap out the page by writing contents to the swap disk.  PAGE must
+ * be the only page in its frame, and unmapped.  Reclaim goes through
+ * anon_swap_out_cluster() instead, many frames at a time. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	struct anon_evict ev;
+
+	frame_table_lock ();
+	anon_evict_init (&ev, page->frame);
+	frame_table_unlock ();
+	if (!anon_swap_out_cluster (&ev, 1))
+		return false;
+	frame_table_lock ();
+	anon_evict_attach (&ev);
+	frame_table_unlock ();
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
+	vm_free_frame (page);
+	anon_discard (page);
+}
+
+/* Frees the copy of PAGE, if any, in zswap or on the swap disk.  If
+ * PAGE is swapped out, it reads back as zeros from now on. */
+void
+anon_discard (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	lock_acquire (&swap_lock);
+	if (anon_page->zentry != NULL) {
+		zswap_free (anon_page->zentry);
+		anon_page->zentry = NULL;
+	}
+	if (anon_page->slot != SWAP_NONE) {
+		slot_put (anon_page->slot);
+		anon_page->slot = SWAP_NONE;
+	}
+	lock_release (&swap_lock);
+}
+
+/* Reads or writes, depending on WRITE, the CNT adjacent slots
+ * beginning at SLOT in one burst, slot I from or into KVAS[I].  The
+ * caller must hold SWAP_LOCK. */
+static void
+swap_io (size_t slot, size_t cnt, void *kvas[], bool write) {
+	size_t i;
+
+	ASSERT (cnt > 0 && cnt <= BURST_SLOTS);
+
+	for (i = 0; i < cnt * SLOT_SECTORS; i++)
+		burst[i] = (uint8_t *) kvas[i / SLOT_SECTORS]
+			+ i % SLOT_SECTORS * DISK_SECTOR_SIZE;
+	if (write)
+		disk_writev (swap_disk, slot * SLOT_SECTORS, cnt * SLOT_SECTORS,
+				(const void **) burst);
+	else
+		disk_readv (swap_disk, slot * SLOT_SECTORS, cnt * SLOT_SECTORS, burst);
+}
+
+void
+anon_print_stats (void) {
+	printf ("Swap: %lld pages out in %lld bursts, %lld pages in, "
+			"%lld read ahead, %lld written back from zswap\n", out_cnt,
+			out_burst_cnt, in_cnt, readahead_cnt, writeback_cnt);
+	printf ("Zero pages: %lld evicted without I/O, %lld given frames "
+			"again\n", zero_out_cnt, zero_in_cnt);
+	zswap_print_stats ();
 }
@@ -0,0 +1,166 @@
+/* area.c: Interval tree of the virtual memory areas of a process.
+ *
+ * The areas of one address space never overlap, so ordering them by
+ * start address also orders them by end address.  That turns the
+ * interval tree into a plain AVL tree keyed by START, and both "which
+ * area contains VA" and "which area first overlaps [START, END)" are
+ * answered by a single descent from the root. */
+
+#include "vm/vm.h"
+
+static int
+height (struct vm_area *a) {
+	return a != NULL ? a->height : 0;
+}
+
+static void
+update_height (struct vm_area *a) {
+	int l = height (a->left), r = height (a->right);
+	a->height = (l > r ? l : r) + 1;
+}
+
+static struct vm_area *
+rotate_right (struct vm_area *a) {
+	struct vm_area *l = a->left;
+	a->left = l->right;
+	l->right = a;
+	update_height (a);
+	update_height (l);
+	return l;
+}
+
+static struct vm_area *
+rotate_left (struct vm_area *a) {
+	struct vm_area *r = a->right;
+	a->right = r->left;
+	r->left = a;
+	update_height (a);
+	update_height (r);
+	return r;
+}
+
+/* Restores the AVL invariant at A, whose subtrees are balanced, and
+ * returns the new root of the subtree. */
+static struct vm_area *
+rebalance (struct vm_area *a) {
+	int balance;
+
+	update_height (a);
+	balance = height (a->left) - height (a->right);
+	if (balance > 1) {
+		if (height (a->left->left) < height (a->left->right))
+			a->left = rotate_left (a->left);
+		return rotate_right (a);
+	} else if (balance < -1) {
+		if (height (a->right->right) < height (a->right->left))
+			a->right = rotate_right (a->right);
+		return rotate_left (a);
+	}
+	return a;
+}
+
+static struct vm_area *
+insert (struct vm_area *root, struct vm_area *area) {
+	if (root == NULL)
+		return area;
+	if (area->start < root->start)
+		root->left = insert (root->left, area);
+	else
+		root->right = insert (root->right, area);
+	return rebalance (root);
+}
+
+/* Unlinks the leftmost node of ROOT into *MIN. */
+static struct vm_area *
+remove_min (struct vm_area *root, struct vm_area **min) {
+	if (root->left == NULL) {
+		*min = root;
+		return root->right;
+	}
+	root->left = remove_min (root->left, min);
+	return rebalance (root);
+}
+
+static struct vm_area *
+remove (struct vm_area *root, struct vm_area *area) {
+	if (root == NULL)
+		return NULL;
+	if (area->start < root->start)
+		root->left = remove (root->left, area);
+	else if (area->start > root->start)
+		root->right = remove (root->right, area);
+	else {
+		struct vm_area *l = root->left, *r = root->right, *min;
+		ASSERT (root == area);
+		if (r == NULL)
+			return l;
+		r = remove_min (r, &min);
+		min->left = l;
+		min->right = r;
+		return rebalance (min);
+	}
+	return rebalance (root);
+}
+
+static bool
+for_each (struct vm_area *root, area_action_func *action, void *aux) {
+	if (root == NULL)
+		return true;
+	return for_each (root->left, action, aux)
+		&& action (root, aux)
+		&& for_each (root->right, action, aux);
+}
+
+/* Inserts AREA into SPT.  Returns false, leaving SPT unchanged, if
+ * AREA overlaps an area already in SPT. */
+bool
+spt_insert_area (struct supplemental_page_table *spt, struct vm_area *area) {
+	ASSERT (area->start < area->end);
+
+	if (spt_find_overlap (spt, area->start, area->end) != NULL)
+		return false;
+	area->left = area->right = NULL;
+	area->height = 1;
+	spt->areas = insert (spt->areas, area);
+	return true;
+}
+
+/* Unlinks AREA from SPT.  Does not touch the pages of AREA. */
+void
+spt_remove_area (struct supplemental_page_table *spt, struct vm_area *area) {
+	spt->areas = remove (spt->areas, area);
+}
+
+/* Returns the area of SPT that contains VA, or a null pointer. */
+struct vm_area *
+spt_find_area (struct supplemental_page_table *spt, const void *va) {
+	return spt_find_overlap (spt, va, (const uint8_t *) va + 1);
+}
+
+/* Returns the lowest area of SPT that overlaps [START, END), or a
+ * null pointer if there is none. */
+struct vm_area *
+spt_find_overlap (struct supplemental_page_table *spt,
+		const void *start, const void *end) {
+	struct vm_area *a = spt->areas, *found = NULL;
+
+	/* Find the lowest area that ends after START... */
+	while (a != NULL) {
+		if ((const void *) a->end > start) {
+			found = a;
+			a = a->left;
+		} else
+			a = a->right;
+	}
+	/* ...and check that it begins before END. */
+	return found != NULL && (const void *) found->start < end ? found : NULL;
+}
+
+/* Calls ACTION on every area of SPT in address order, stopping early
+ * if ACTION returns false.  ACTION must not add or remove areas.
+ * Returns false if ACTION did. */
+bool
+spt_for_each_area (struct supplemental_page_table *spt,
+		area_action_func *action, void *aux) {
+	return for_each (spt->areas, action, aux);
+}
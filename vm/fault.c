@@ -0,0 +1,199 @@
+/* fault.c: Page fault statistics.
+ *
+ * Every fault that vm_try_handle_fault() serves is recorded here with
+ * its kind (see <fault-stats.h>), the VM type of its page, its latency
+ * in TSC cycles and the instruction that took it.  Latencies go into
+ * log2 histograms, one per kind and one per VM type; each process also
+ * counts its own minor and major faults.
+ *
+ * The instructions that fault most are found with the space-saving
+ * algorithm over FAULT_TRACK counters: an instruction that is not
+ * tracked yet takes over the counter with the smallest count, and adds
+ * one to it.  Counts may be overestimated, but every instruction that
+ * takes more than 1/FAULT_TRACK of all faults is tracked.
+ *
+ * Interrupts are turned off while the statistics are updated. */
+
+#include "vm/fault.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "vm/vm.h"
+
+/* Instructions tracked. */
+#define FAULT_TRACK 32
+
+/* The system-wide statistics; TOP is filled in when they are read. */
+static struct fault_stats stats;
+
+/* Counters of the space-saving algorithm. */
+static struct {
+	uintptr_t rip;
+	long long cnt;
+} track[FAULT_TRACK];
+
+/* A copy of the statistics for fault_get_stats(), made with
+ * interrupts off and then copied out to the user. */
+static struct lock snapshot_lock;
+static struct fault_stats snapshot;
+
+static const char *kind_names[FAULT_KIND_CNT] = {
+	"zero", "resident", "cow", "file", "swap",
+};
+static const char *type_names[FAULT_TYPE_CNT] = {
+	"anon", "file", "cache",
+};
+
+void
+fault_init (void) {
+	lock_init (&snapshot_lock);
+}
+
+/* Returns the histogram bucket of a fault that took CYCLES. */
+static size_t
+hist_bucket (uint64_t cycles) {
+	size_t bucket = 0;
+
+	for (cycles >>= FAULT_HIST_SHIFT + 1;
+			cycles > 0 && bucket < FAULT_HIST_BUCKETS - 1; cycles >>= 1)
+		bucket++;
+	return bucket;
+}
+
+/* Counts one more fault taken by the instruction at RIP. */
+static void
+track_rip (uintptr_t rip) {
+	size_t i, min = 0;
+
+	for (i = 0; i < FAULT_TRACK; i++) {
+		if (track[i].rip == rip && track[i].cnt > 0) {
+			track[i].cnt++;
+			return;
+		}
+		if (track[i].cnt < track[min].cnt)
+			min = i;
+	}
+	track[min].rip = rip;
+	track[min].cnt++;
+}
+
+/* Records a fault of KIND on a page of TYPE, taken by the instruction
+ * at RIP in the current thread, that took CYCLES to serve. */
+void
+fault_record (enum fault_kind kind, enum vm_type type, uintptr_t rip,
+		uint64_t cycles) {
+	struct thread *t = thread_current ();
+	size_t bucket = hist_bucket (cycles);
+	enum intr_level old_level;
+
+	ASSERT (kind < FAULT_KIND_CNT);
+
+	old_level = intr_disable ();
+	if (FAULT_IS_MAJOR (kind))
+		t->major_faults++;
+	else
+		t->minor_faults++;
+	stats.kind_cnt[kind]++;
+	stats.kind_cycles[kind] += cycles;
+	stats.kind_hist[kind][bucket]++;
+	if (type >= VM_ANON && type < VM_ANON + FAULT_TYPE_CNT)
+		stats.type_hist[type - VM_ANON][bucket]++;
+	track_rip (rip);
+	intr_set_level (old_level);
+}
+
+/* Fills in the TOP member of S from the tracked instructions.
+ * Interrupts must be off. */
+static void
+fill_top (struct fault_stats *s) {
+	bool taken[FAULT_TRACK] = { false };
+	size_t i, j;
+
+	for (i = 0; i < FAULT_TOP_CNT; i++) {
+		size_t best = FAULT_TRACK;
+
+		for (j = 0; j < FAULT_TRACK; j++)
+			if (!taken[j] && track[j].cnt > 0
+					&& (best == FAULT_TRACK || track[j].cnt > track[best].cnt))
+				best = j;
+		if (best == FAULT_TRACK) {
+			s->top[i].rip = 0;
+			s->top[i].cnt = 0;
+			continue;
+		}
+		taken[best] = true;
+		s->top[i].rip = track[best].rip;
+		s->top[i].cnt = track[best].cnt;
+	}
+}
+
+/* Copies the fault statistics of the system and of the current
+ * process to the user buffer OUT.  Returns false if OUT is not a
+ * writable user buffer. */
+bool
+fault_get_stats (struct fault_stats *out) {
+	struct thread *t = thread_current ();
+	enum intr_level old_level;
+
+	if (!vm_user_range_ok (out, sizeof *out, true))
+		return false;
+
+	lock_acquire (&snapshot_lock);
+	old_level = intr_disable ();
+	snapshot = stats;
+	fill_top (&snapshot);
+	snapshot.minor_cnt = t->minor_faults;
+	snapshot.major_cnt = t->major_faults;
+	intr_set_level (old_level);
+	/* May fault, so with interrupts on. */
+	memcpy (out, &snapshot, sizeof *out);
+	lock_release (&snapshot_lock);
+	return true;
+}
+
+/* Prints the nonempty prefix of histogram HIST. */
+static void
+print_hist (const long long hist[FAULT_HIST_BUCKETS]) {
+	int last, i;
+
+	for (last = FAULT_HIST_BUCKETS - 1; last > 0 && hist[last] == 0; last--)
+		continue;
+	for (i = 0; i <= last; i++)
+		printf (" %lld", hist[i]);
+	printf ("\n");
+}
+
+void
+fault_print_stats (void) {
+	long long minor_cnt = 0, major_cnt = 0;
+	int i;
+
+	for (i = 0; i < FAULT_KIND_CNT; i++) {
+		if (FAULT_IS_MAJOR (i))
+			major_cnt += stats.kind_cnt[i];
+		else
+			minor_cnt += stats.kind_cnt[i];
+	}
+	printf ("Page faults: %lld minor, %lld major; latency buckets double "
+			"from 2^%d cycles\n", minor_cnt, major_cnt, FAULT_HIST_SHIFT + 1);
+	for (i = 0; i < FAULT_KIND_CNT; i++) {
+		long long cnt = stats.kind_cnt[i];
+
+		printf ("  %-8s %lld, avg %lld cycles:", kind_names[i], cnt,
+				cnt > 0 ? stats.kind_cycles[i] / cnt : 0);
+		print_hist (stats.kind_hist[i]);
+	}
+	for (i = 0; i < FAULT_TYPE_CNT; i++) {
+		printf ("  %-8s", type_names[i]);
+		print_hist (stats.type_hist[i]);
+	}
+
+	fill_top (&stats);
+	printf ("  Top faulting instructions:");
+	for (i = 0; i < FAULT_TOP_CNT && stats.top[i].cnt > 0; i++)
+		printf (" %p (%lld)", (void *) stats.top[i].rip, stats.top[i].cnt);
+	printf ("\n");
+}
@@ -1,10 +1,35 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <mman.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
 #include "vm/vm.h"
 
+/* Most pages written back in one disk request. */
+#define SYNC_RUN (DISK_BURST_MAX * DISK_SECTOR_SIZE / PGSIZE)
+
+/* Adjacent dirty pages of a file mapping, collected by file_sync(). */
+struct sync_run {
+	const void *kvas[SYNC_RUN];   /* Their frames. */
+	size_t cnt;                   /* Pages. */
+	off_t offset;                 /* File offset of the first. */
+	off_t size;                   /* Bytes to write. */
+};
+
+/* Write-back statistics. */
+static long long sync_page_cnt;       /* Dirty pages written back. */
+static long long sync_write_cnt;      /* Disk requests that took. */
+static long long sync_clean_cnt;      /* Resident pages found clean. */
+
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
 static void file_backed_destroy (struct page *page);
+static bool file_lazy_load (struct page *page, void *aux);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations file_ops = {
@@ -21,38 +46,202 @@ vm_file_init (void) {
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
 	struct file_page *file_page = &page->file;
+	struct vm_area *area = page->area;
+
+	ASSERT (area != NULL && area->file != NULL);
+	file_page->file = area->file;
+	file_page->read_bytes = vm_area_read_bytes (area, page->va,
+			&file_page->offset);
+	return true;
+}
+
+/* Reads the file contents of PAGE into KVA and zeroes the rest. */
+static bool
+file_read_page (struct page *page, void *kva) {
+	struct file_page *file_page = &page->file;
+
+	if (file_read_at (file_page->file, kva, file_page->read_bytes,
+				file_page->offset) != (off_t) file_page->read_bytes)
+		return false;
+	memset ((uint8_t *) kva + file_page->read_bytes, 0,
+			PGSIZE - file_page->read_bytes);
+	return true;
+}
+
+/* Writes PAGE back to its file if the process modified it. */
+static void
+file_write_back (struct page *page) {
+	struct file_page *file_page = &page->file;
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (page->frame == NULL || pml4 == NULL
+			|| !pml4_is_dirty (pml4, page->va))
+		return;
+	file_write_at (file_page->file, page->frame->kva, file_page->read_bytes,
+			file_page->offset);
+	pml4_set_dirty (pml4, page->va, false);
+}
+
+/* Fills a page of an mmap area on first touch. */
+static bool
+file_lazy_load (struct page *page, void *aux UNUSED) {
+	return file_read_page (page, page->frame->kva);
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	return file_read_page (page, kva);
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	file_write_back (page);
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	file_write_back (page);
+	vm_free_frame (page);
+}
+
+/* Writes RUN, if it has any pages, to FILE and empties it. */
+static void
+sync_run_flush (struct file *file, struct sync_run *run) {
+	if (run->cnt == 0)
+		return;
+	file_write_pages_at (file, run->kvas, run->size, run->offset);
+	sync_page_cnt += run->cnt;
+	sync_write_cnt++;
+	run->cnt = 0;
+	run->size = 0;
+}
+
+/* Writes the pages of AREA, a file mapping of the current process, in
+ * [START, END) back to the file if they were modified, and marks them
+ * clean.  Clean and nonresident pages cost nothing; adjacent dirty
+ * pages go out together, up to SYNC_RUN pages per disk request.  The
+ * frame table lock is held throughout, so that no page is evicted
+ * while it is being written; a page under eviction is waited for, and
+ * found clean, since its evicter writes it. */
+void
+file_sync (struct vm_area *area, void *start, void *end) {
+	struct thread *owner = vm_owner ();
+	struct sync_run run;
+	uint8_t *va;
+
+	ASSERT (area->file != NULL);
+
+	if (owner->pml4 == NULL)
+		return;
+	run.cnt = 0;
+	run.size = 0;
+	frame_table_lock ();
+	for (va = start; va < (uint8_t *) end; va += PGSIZE) {
+		struct page *page = spt_find_page (&owner->spt, va);
+		struct file_page *file_page;
+
+		/* Waiting releases the lock, and the frames of the run with
+		 * it. */
+		if (page != NULL && page->frame != NULL && page->frame->evicting) {
+			sync_run_flush (area->file, &run);
+			vm_page_frame (page);
+		}
+		if (page == NULL || page->frame == NULL
+				|| VM_TYPE (page->operations->type) != VM_FILE
+				|| page->file.read_bytes == 0) {
+			sync_run_flush (area->file, &run);
+			continue;
+		}
+		if (!pml4_is_dirty (owner->pml4, va)) {
+			sync_run_flush (area->file, &run);
+			sync_clean_cnt++;
+			continue;
+		}
+		/* Clean from here; a write during the I/O dirties it again. */
+		pml4_set_dirty (owner->pml4, va, false);
+		file_page = &page->file;
+		if (run.cnt == 0)
+			run.offset = file_page->offset;
+		run.kvas[run.cnt++] = page->frame->kva;
+		run.size += file_page->read_bytes;
+		/* The file ends in a partial page. */
+		if (run.cnt == SYNC_RUN || file_page->read_bytes < PGSIZE)
+			sync_run_flush (area->file, &run);
+	}
+	sync_run_flush (area->file, &run);
+	frame_table_unlock ();
+}
+
+void
+file_print_stats (void) {
+	printf ("Write-back: %lld dirty pages in %lld writes, %lld clean pages "
+			"skipped\n", sync_page_cnt, sync_write_cnt, sync_clean_cnt);
 }
 
-/* Do the mmap */
+/* Do the mmap.  Besides whether the mapping is writable, WRITABLE
+ * may carry mmap() flags.  With MAP_POPULATE, the whole mapping is
+ * loaded now rather than on first touch.  With MAP_ANONYMOUS, the
+ * mapping is of zeros and FILE must be null; ADDR may then be null
+ * too, to let vm_find_unmapped() choose it. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	bool populate = (writable & MAP_POPULATE) != 0;
+	bool anonymous = (writable & MAP_ANONYMOUS) != 0;
+	struct vm_area *area;
+	off_t file_len = 0;
+	size_t read_bytes;
+	void *end;
+
+	if (anonymous && addr == NULL && length > 0)
+		addr = vm_find_unmapped (length);
+	if (addr == NULL || pg_ofs (addr) != 0 || offset < 0
+			|| offset % PGSIZE != 0 || length == 0
+			|| (file == NULL) != anonymous)
+		return NULL;
+	end = (uint8_t *) addr + ROUND_UP (length, PGSIZE);
+	if (end <= addr || !is_user_vaddr (addr) || !is_user_vaddr (end - 1))
+		return NULL;
+	if (!anonymous && (file_len = file_length (file)) == 0)
+		return NULL;
+	if (spt_find_overlap (spt, addr, end) != NULL)
+		return NULL;
+
+	writable = (writable & ~(MAP_POPULATE | MAP_ANONYMOUS)) != 0;
+	if (anonymous)
+		area = vm_area_add (spt, addr, end, VM_ANON | VM_MMAP, writable,
+				NULL, NULL, 0, 0);
+	else {
+		read_bytes = offset < file_len ? (size_t) (file_len - offset) : 0;
+		if (read_bytes > length)
+			read_bytes = length;
+		area = vm_area_add (spt, addr, end, VM_FILE | VM_MMAP, writable,
+				file_lazy_load, file, offset, read_bytes);
+	}
+	if (area == NULL)
+		return NULL;
+	if (populate)
+		vm_populate (area);
+	return addr;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	struct vm_area *area = spt_find_area (spt, addr);
+
+	if (area != NULL && area->start == addr && (area->type & VM_MMAP))
+		vm_area_destroy (spt, area);
 }
@@ -0,0 +1,354 @@
+/* filemap.c: Page cache of file pages, shared between mappings.
+ *
+ * A page of a file-backed area is looked up here, by the inode and
+ * page number of its file page, before it is read from disk.  All the
+ * pages that map the same file page, in any process, then share one
+ * frame, which lists them in its page list; its MAP_CNT counts them.
+ * When the last of them goes away the frame stays cached, idle on the
+ * clock with no page, so that the next process to map the file still
+ * finds it, until the cold hand reclaims it.
+ *
+ * The cached frames of one inode form a radix tree indexed by page
+ * number, RADIX_SHIFT bits per level, which grows upward as larger
+ * page numbers are added.  Writes to the file through inode_write_at()
+ * are copied into the cached frames, so the cache never goes stale,
+ * and the frames of a removed inode are dropped when it is closed for
+ * the last time.
+ *
+ * FILEMAP_LOCK protects the trees and nests inside the frame table
+ * lock.  A cached frame is removed from its tree before it is freed or
+ * reused. */
+
+#include "vm/filemap.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/vm.h"
+
+#define RADIX_SHIFT 6
+#define RADIX_SLOTS (1 << RADIX_SHIFT)
+#define RADIX_MAX_HEIGHT ((64 + RADIX_SHIFT - 1) / RADIX_SHIFT)
+
+/* A node of a radix tree. */
+struct radix_node {
+	void *slots[RADIX_SLOTS];     /* Children, or frames at the bottom. */
+	unsigned cnt;                 /* Nonnull slots. */
+};
+
+/* The cached pages of one inode. */
+struct file_mapping {
+	struct hash_elem elem;        /* Element in MAPPINGS. */
+	disk_sector_t inumber;        /* The inode. */
+	struct radix_node *root;      /* Tree of frames, or NULL if empty. */
+	int height;                   /* Levels in the tree. */
+	size_t page_cnt;              /* Frames in the tree. */
+};
+
+static struct lock filemap_lock;      /* Protects everything below. */
+static struct hash mappings;          /* File mappings by inode. */
+static size_t cached_cnt;             /* Frames in all trees. */
+
+/* Statistics. */
+static long long hit_cnt;             /* Lookups that found a frame. */
+static long long miss_cnt;            /* Lookups that did not. */
+
+static uint64_t mapping_hash (const struct hash_elem *, void *);
+static bool mapping_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+
+void
+filemap_init (void) {
+	lock_init (&filemap_lock);
+	if (!hash_init (&mappings, mapping_hash, mapping_less, NULL))
+		PANIC ("filemap_init: out of memory");
+}
+
+/* Returns the mapping of INUMBER, creating it if CREATE is true.
+ * Returns a null pointer if there is none or memory is short. */
+static struct file_mapping *
+mapping_get (disk_sector_t inumber, bool create) {
+	struct file_mapping key, *m;
+	struct hash_elem *e;
+
+	key.inumber = inumber;
+	e = hash_find (&mappings, &key.elem);
+	if (e != NULL)
+		return hash_entry (e, struct file_mapping, elem);
+	if (!create || (m = calloc (1, sizeof *m)) == NULL)
+		return NULL;
+	m->inumber = inumber;
+	hash_insert (&mappings, &m->elem);
+	return m;
+}
+
+/* Returns whether page INDEX fits in a tree of HEIGHT levels. */
+static bool
+radix_fits (int height, size_t index) {
+	return height >= RADIX_MAX_HEIGHT
+		|| (index >> (height * RADIX_SHIFT)) == 0;
+}
+
+/* Returns the slot of page INDEX in the tree of M, and stores the node
+ * that holds it into *LEAF if LEAF is nonnull.  If CREATE is true,
+ * grows the tree as needed; otherwise returns a null pointer if the
+ * slot does not exist.  Also returns a null pointer if memory is
+ * short. */
+static void **
+radix_slot (struct file_mapping *m, size_t index, bool create,
+		struct radix_node **leaf) {
+	struct radix_node *node;
+	int level;
+
+	if (m->root == NULL || !radix_fits (m->height, index)) {
+		if (!create)
+			return NULL;
+		if (m->root == NULL) {
+			if ((m->root = calloc (1, sizeof *m->root)) == NULL)
+				return NULL;
+			m->height = 1;
+		}
+		while (!radix_fits (m->height, index)) {
+			struct radix_node *up = calloc (1, sizeof *up);
+			if (up == NULL)
+				return NULL;
+			up->slots[0] = m->root;
+			up->cnt = 1;
+			m->root = up;
+			m->height++;
+		}
+	}
+
+	node = m->root;
+	for (level = m->height - 1; level > 0; level--) {
+		void **slot = &node->slots[(index >> (level * RADIX_SHIFT))
+			& (RADIX_SLOTS - 1)];
+		if (*slot == NULL) {
+			if (!create || (*slot = calloc (1, sizeof *node)) == NULL)
+				return NULL;
+			node->cnt++;
+		}
+		node = *slot;
+	}
+	if (leaf != NULL)
+		*leaf = node;
+	return &node->slots[index & (RADIX_SLOTS - 1)];
+}
+
+/* Removes page INDEX from the tree of M, freeing the nodes that
+ * become empty. */
+static void
+radix_delete (struct file_mapping *m, size_t index) {
+	struct radix_node *path[RADIX_MAX_HEIGHT];
+	struct radix_node *node = m->root;
+	int level, depth = 0;
+
+	for (level = m->height - 1; level >= 0; level--) {
+		ASSERT (node != NULL);
+		path[depth++] = node;
+		if (level > 0)
+			node = node->slots[(index >> (level * RADIX_SHIFT))
+				& (RADIX_SLOTS - 1)];
+	}
+
+	/* Clear the leaf slot, then free the nodes left empty bottom up. */
+	for (level = 0; level < m->height; level++) {
+		struct radix_node *n = path[--depth];
+		n->slots[(index >> (level * RADIX_SHIFT)) & (RADIX_SLOTS - 1)] = NULL;
+		if (--n->cnt > 0)
+			return;
+		free (n);
+	}
+	m->root = NULL;
+	m->height = 0;
+}
+
+/* Frees the tree below NODE, of HEIGHT levels, and its frames.  The
+ * frame table lock must be held. */
+static void
+radix_destroy (struct radix_node *node, int height) {
+	int i;
+
+	for (i = 0; i < RADIX_SLOTS; i++) {
+		if (node->slots[i] == NULL)
+			continue;
+		if (height > 1)
+			radix_destroy (node->slots[i], height - 1);
+		else {
+			struct frame *frame = node->slots[i];
+
+			frame->mapping = NULL;
+			cached_cnt--;
+			/* A frame still in use goes when its last page does, one
+			 * under eviction when its evicter is done. */
+			if (frame->map_cnt == 0 && frame->pin_cnt == 0) {
+				frame_table_remove (frame);
+				palloc_free_page (frame->kva);
+				free (frame);
+			}
+		}
+	}
+	free (node);
+}
+
+/* Returns the cached frame of page INDEX of INODE, or a null pointer.
+ * The caller must hold the frame table lock for as long as it uses
+ * the frame. */
+struct frame *
+filemap_find (struct inode *inode, size_t index) {
+	struct file_mapping *m;
+	struct frame *frame = NULL;
+
+	lock_acquire (&filemap_lock);
+	m = mapping_get (inode_get_inumber (inode), false);
+	if (m != NULL) {
+		void **slot = radix_slot (m, index, false, NULL);
+		if (slot != NULL)
+			frame = *slot;
+	}
+	if (frame != NULL)
+		hit_cnt++;
+	else
+		miss_cnt++;
+	lock_release (&filemap_lock);
+	return frame;
+}
+
+/* Returns whether page INDEX of INODE is cached, without counting a
+ * hit or a miss. */
+bool
+filemap_contains (struct inode *inode, size_t index) {
+	struct file_mapping *m;
+	bool found = false;
+
+	lock_acquire (&filemap_lock);
+	m = mapping_get (inode_get_inumber (inode), false);
+	if (m != NULL) {
+		void **slot = radix_slot (m, index, false, NULL);
+		found = slot != NULL && *slot != NULL;
+	}
+	lock_release (&filemap_lock);
+	return found;
+}
+
+/* Caches FRAME, which holds page INDEX of INODE, in the page cache.
+ * Returns false if the page is already cached or memory is short.  The
+ * caller must hold the frame table lock. */
+bool
+filemap_add (struct inode *inode, size_t index, struct frame *frame) {
+	struct file_mapping *m;
+	struct radix_node *leaf;
+	void **slot = NULL;
+
+	ASSERT (frame->mapping == NULL);
+
+	lock_acquire (&filemap_lock);
+	m = mapping_get (inode_get_inumber (inode), true);
+	if (m != NULL)
+		slot = radix_slot (m, index, true, &leaf);
+	if (slot == NULL || *slot != NULL) {
+		lock_release (&filemap_lock);
+		return false;
+	}
+	*slot = frame;
+	leaf->cnt++;
+	m->page_cnt++;
+	cached_cnt++;
+	frame->mapping = m;
+	frame->index = index;
+	lock_release (&filemap_lock);
+	return true;
+}
+
+/* Removes FRAME from the page cache, if it is there.  The caller must
+ * hold the frame table lock. */
+void
+filemap_remove (struct frame *frame) {
+	struct file_mapping *m = frame->mapping;
+
+	if (m == NULL)
+		return;
+	lock_acquire (&filemap_lock);
+	radix_delete (m, frame->index);
+	frame->mapping = NULL;
+	cached_cnt--;
+	if (--m->page_cnt == 0) {
+		hash_delete (&mappings, &m->elem);
+		free (m);
+	}
+	lock_release (&filemap_lock);
+}
+
+/* Copies SIZE bytes from BUF, just written to INODE at offset OFS,
+ * into the cached frames of INODE that they fall in. */
+void
+filemap_write (struct inode *inode, off_t ofs, const void *buf,
+		size_t size) {
+	const uint8_t *src = buf;
+	struct file_mapping *m;
+
+	lock_acquire (&filemap_lock);
+	m = mapping_get (inode_get_inumber (inode), false);
+	while (m != NULL && size > 0) {
+		size_t page_ofs = ofs % PGSIZE;
+		size_t chunk = PGSIZE - page_ofs < size ? PGSIZE - page_ofs : size;
+		void **slot = radix_slot (m, ofs / PGSIZE, false, NULL);
+
+		if (slot != NULL && *slot != NULL) {
+			uint8_t *dst = (uint8_t *) ((struct frame *) *slot)->kva + page_ofs;
+			/* A cached frame written back to its own file. */
+			if (dst != src)
+				memcpy (dst, src, chunk);
+		}
+		src += chunk;
+		ofs += chunk;
+		size -= chunk;
+	}
+	lock_release (&filemap_lock);
+}
+
+/* Drops every cached page of INODE, which is being deleted. */
+void
+filemap_forget_inode (struct inode *inode) {
+	struct file_mapping *m;
+
+	frame_table_lock ();
+	lock_acquire (&filemap_lock);
+	m = mapping_get (inode_get_inumber (inode), false);
+	if (m != NULL) {
+		if (m->root != NULL)
+			radix_destroy (m->root, m->height);
+		hash_delete (&mappings, &m->elem);
+		free (m);
+	}
+	lock_release (&filemap_lock);
+	frame_table_unlock ();
+}
+
+void
+filemap_print_stats (void) {
+	printf ("Page cache: %zu pages of %zu files, %lld hits, %lld misses\n",
+			cached_cnt, hash_size (&mappings), hit_cnt, miss_cnt);
+}
+
+/* Hash function and comparison for file mappings. */
+static uint64_t
+mapping_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct file_mapping *m = hash_entry (e, struct file_mapping, elem);
+	return hash_int (m->inumber);
+}
+
+static bool
+mapping_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct file_mapping, elem)->inumber
+		< hash_entry (b, struct file_mapping, elem)->inumber;
+}
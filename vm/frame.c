@@ -0,0 +1,518 @@
+/* frame.c: Global frame table and CLOCK-Pro page replacement.
+ *
+ * Every user frame that holds a loaded page sits on one circular list,
+ * the clock, swept by two hands.  A frame is either hot (part of some
+ * working set) or cold (a candidate for eviction).  A cold frame also
+ * has a test period: a cold page that is referenced again while in its
+ * test period has proven that it is reused and turns hot.
+ *
+ *   - The cold hand looks for a victim among the cold frames.  An
+ *     unreferenced cold frame is evicted; a referenced one is promoted
+ *     if it was in its test period and otherwise starts a new one.
+ *
+ *   - The hot hand keeps the hot frames within their share of memory,
+ *     demoting hot frames that were not referenced since its last
+ *     pass, and ends the test periods of the cold frames it passes.
+ *
+ * A cold page evicted during its test period leaves behind a ghost:
+ * the identity of the page without its frame.  A page that faults back
+ * in while its ghost still exists was evicted too early, so it comes
+ * back hot and the cold share grows; a ghost that expires unused means
+ * the cold share may shrink.  Pages touched once by a sequential scan
+ * never get a second reference, so they cycle through the cold share
+ * without ever displacing the hot working set.
+ *
+ * The "referenced" bit is the accessed bit of the PTEs of the pages
+ * mapping the frame; a frame shared by several pages is referenced if
+ * any of them is.  The first reference, made by the very fault that
+ * loaded the page, is discarded. */
+
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "vm/frame.h"
+#include "vm/ksm.h"
+#include "vm/rss.h"
+#include "vm/vm.h"
+
+/* The identity of a page evicted during its test period. */
+struct ghost {
+	struct hash_elem hash_elem;   /* Element in GHOSTS. */
+	struct list_elem list_elem;   /* Element in GHOST_LIST, oldest first. */
+	tid_t tid;                    /* Process that owned the evicted page. */
+	void *va;                     /* Its user virtual address. */
+};
+
+static struct lock frame_lock;        /* Protects everything below. */
+static struct condition evict_done;   /* Signaled when evictions end. */
+static struct list clock;             /* All resident, evictable frames. */
+static struct list_elem *hand_cold;   /* Next frame the cold hand visits. */
+static struct list_elem *hand_hot;    /* Next frame the hot hand visits. */
+static struct list_elem *hand_scan;   /* Next frame frame_table_scan() visits. */
+static size_t frame_cnt;              /* Frames on the clock. */
+static size_t hot_cnt;                /* Hot frames on the clock. */
+static size_t cold_target;            /* Adaptive share of cold frames. */
+
+static struct hash ghosts;            /* Ghosts by (tid, va). */
+static struct list ghost_list;        /* Ghosts, oldest first. */
+static size_t ghost_cnt;
+
+/* Statistics. */
+static long long hit_cnt;             /* References found by a hand. */
+static long long evict_cnt;           /* Frames evicted. */
+static long long refault_cnt;         /* Pages refaulted while a ghost. */
+static long long deactivate_cnt;      /* Frames pushed to the cold hand. */
+
+static uint64_t ghost_hash (const struct hash_elem *, void *);
+static bool ghost_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+
+void
+frame_table_init (void) {
+	lock_init (&frame_lock);
+	cond_init (&evict_done);
+	list_init (&clock);
+	list_init (&ghost_list);
+	if (!hash_init (&ghosts, ghost_hash, ghost_less, NULL))
+		PANIC ("frame_table_init: out of memory");
+	cold_target = 1;
+}
+
+void
+frame_table_lock (void) {
+	lock_acquire (&frame_lock);
+}
+
+void
+frame_table_unlock (void) {
+	lock_release (&frame_lock);
+}
+
+/* Waits, with the frame table lock released meanwhile, until some
+ * eviction in progress ends.  The caller must hold the frame table
+ * lock. */
+void
+frame_table_wait (void) {
+	cond_wait (&evict_done, &frame_lock);
+}
+
+/* Wakes up every thread in frame_table_wait().  The caller must hold
+ * the frame table lock. */
+void
+frame_table_wake (void) {
+	cond_broadcast (&evict_done, &frame_lock);
+}
+
+/* Returns the frame after E on the clock, wrapping around. */
+static struct list_elem *
+clock_next (struct list_elem *e) {
+	e = list_next (e);
+	return e != list_end (&clock) ? e : list_begin (&clock);
+}
+
+/* Puts FRAME on the clock where the cold hand will reach it last. */
+static void
+clock_insert (struct frame *frame) {
+	if (hand_cold == NULL) {
+		list_push_back (&clock, &frame->clock_elem);
+		hand_cold = hand_hot = &frame->clock_elem;
+	} else
+		list_insert (hand_cold, &frame->clock_elem);
+	frame->linked = true;
+	frame_cnt++;
+	if (frame->hot)
+		hot_cnt++;
+}
+
+/* Takes FRAME off the clock, moving any hand that points to it. */
+static void
+clock_remove (struct frame *frame) {
+	struct list_elem *e = &frame->clock_elem;
+	struct list_elem *next = clock_next (e);
+
+	if (next == e)
+		next = NULL;
+	if (hand_cold == e)
+		hand_cold = next;
+	if (hand_hot == e)
+		hand_hot = next;
+	if (hand_scan == e)
+		hand_scan = next;
+	list_remove (e);
+	frame->linked = false;
+	frame_cnt--;
+	if (frame->hot)
+		hot_cnt--;
+}
+
+/* Returns whether any page in FRAME was referenced since the last
+ * call, and clears their reference bits.  An idle page cache frame is
+ * mapped nowhere and never referenced. */
+static bool
+frame_referenced (struct frame *frame) {
+	struct list_elem *e;
+	bool referenced;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		/* The working set sampler may have taken the accessed bit. */
+		if (pml4 != NULL && pml4_is_accessed (pml4, page->va)) {
+			pml4_set_accessed (pml4, page->va, false);
+			frame->accessed = true;
+		}
+	}
+	if (!frame->accessed)
+		return false;
+	frame->accessed = false;
+	referenced = !frame->fresh;
+	frame->fresh = false;
+	if (referenced)
+		hit_cnt++;
+	return referenced;
+}
+
+/* The cold share shrinks when a test period ends unused... */
+static void
+cold_shrink (void) {
+	if (cold_target > 1)
+		cold_target--;
+}
+
+/* ...and grows when a page proves it was evicted too early. */
+static void
+cold_grow (void) {
+	if (cold_target + 1 < frame_cnt)
+		cold_target++;
+}
+
+/* Runs the hot hand until the hot frames fit their share of memory,
+ * or until it has gone around the clock twice. */
+static void
+run_hand_hot (void) {
+	size_t steps;
+
+	for (steps = 0; steps < 2 * frame_cnt && hand_hot != NULL; steps++) {
+		struct frame *f;
+		size_t hot_target = frame_cnt > cold_target
+			? frame_cnt - cold_target : 0;
+
+		if (hot_cnt <= hot_target)
+			break;
+		f = list_entry (hand_hot, struct frame, clock_elem);
+		hand_hot = clock_next (hand_hot);
+		if (f->pin_cnt > 0)
+			continue;
+		if (f->hot) {
+			if (!frame_referenced (f)) {
+				f->hot = false;
+				f->test = false;
+				hot_cnt--;
+			}
+		} else if (f->test) {
+			f->test = false;
+			cold_shrink ();
+		}
+	}
+}
+
+/* Records that the page in FRAME was evicted during its test period,
+ * expiring the oldest ghost if there are as many ghosts as frames. */
+static void
+ghost_add (struct frame *frame) {
+	struct ghost *g = malloc (sizeof *g);
+	struct hash_elem *e;
+
+	if (g == NULL)
+		return;
+	g->tid = frame->page->owner->tid;
+	g->va = frame->page->va;
+	e = hash_replace (&ghosts, &g->hash_elem);
+	if (e != NULL) {
+		/* Left when the same page was evicted before. */
+		struct ghost *stale = hash_entry (e, struct ghost, hash_elem);
+		list_remove (&stale->list_elem);
+		free (stale);
+		ghost_cnt--;
+	}
+	list_push_back (&ghost_list, &g->list_elem);
+	ghost_cnt++;
+
+	while (ghost_cnt > frame_cnt && ghost_cnt > 0) {
+		struct ghost *old = list_entry (list_pop_front (&ghost_list),
+				struct ghost, list_elem);
+		hash_delete (&ghosts, &old->hash_elem);
+		free (old);
+		ghost_cnt--;
+		cold_shrink ();
+	}
+}
+
+/* If the page in FRAME left a ghost behind, removes the ghost and
+ * returns true. */
+static bool
+ghost_take (struct frame *frame) {
+	struct ghost key;
+	struct hash_elem *e;
+	struct ghost *g;
+
+	key.tid = frame->page->owner->tid;
+	key.va = frame->page->va;
+	e = hash_delete (&ghosts, &key.hash_elem);
+	if (e == NULL)
+		return false;
+	g = hash_entry (e, struct ghost, hash_elem);
+	list_remove (&g->list_elem);
+	free (g);
+	ghost_cnt--;
+	return true;
+}
+
+/* Adds FRAME, which now holds its loaded page, to the frame table.
+ * A page returning within its test period comes back hot; any other
+ * page starts cold, in its test period. */
+void
+frame_table_insert (struct frame *frame) {
+	ASSERT (frame->page != NULL);
+
+	lock_acquire (&frame_lock);
+	ASSERT (!frame->linked);
+	frame->fresh = true;
+	frame->accessed = false;
+	frame->idle_age = 0;
+	if (ghost_take (frame)) {
+		refault_cnt++;
+		cold_grow ();
+		frame->hot = true;
+		frame->test = false;
+	} else {
+		frame->hot = false;
+		frame->test = true;
+	}
+	clock_insert (frame);
+	if (frame->hot)
+		run_hand_hot ();
+	lock_release (&frame_lock);
+}
+
+/* Removes FRAME, which is going away, from the frame table, if it is
+ * there, and from same-page merging.  The caller must hold the frame
+ * table lock. */
+void
+frame_table_remove (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (frame->linked)
+		clock_remove (frame);
+	ksm_forget (frame);
+}
+
+/* Returns whether one of the pages in FRAME belongs to OWNER. */
+static bool
+frame_owned_by (struct frame *frame, struct thread *owner) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e))
+		if (list_entry (e, struct page, frame_elem)->owner == owner)
+			return true;
+	return false;
+}
+
+/* Chooses a frame to evict with the cold hand and takes it off the
+ * clock and out of same-page merging.  Its pages, which may be several
+ * if the frame is shared, are still loaded and mapped.  If OWNER is
+ * nonnull, only a frame mapped by one of OWNER's pages is chosen.
+ * Returns a null pointer if every frame is pinned.  The caller must
+ * hold the frame table lock. */
+struct frame *
+frame_table_victim (struct thread *owner) {
+	size_t steps;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	/* Each frame needs at most four visits: one to drop the first
+	 * reference, one to start a test period, one to promote, and one
+	 * to evict once the hot hand has demoted it again. */
+	for (steps = 0; steps < 4 * frame_cnt && hand_cold != NULL; steps++) {
+		struct frame *f;
+
+		run_hand_hot ();
+		f = list_entry (hand_cold, struct frame, clock_elem);
+		hand_cold = clock_next (hand_cold);
+		if (owner != NULL && !frame_owned_by (f, owner))
+			continue;
+		if (f->hot || f->pin_cnt > 0)
+			continue;
+
+		if (frame_referenced (f)) {
+			if (f->test) {
+				f->hot = true;
+				f->test = false;
+				hot_cnt++;
+			} else {
+				/* Move it behind the hand to start a test period. */
+				clock_remove (f);
+				f->test = true;
+				clock_insert (f);
+			}
+		} else if (f->fresh) {
+			/* Only ever touched by the fault that loaded it. */
+			f->fresh = false;
+		} else {
+			/* On the first rounds, spare the processes within their
+			 * limits and working sets if others are over theirs. */
+			if (owner == NULL && steps < 2 * frame_cnt && f->page != NULL
+					&& rss_any_over () && !rss_over (f->page->owner))
+				continue;
+			if (f->test && f->page != NULL)
+				ghost_add (f);
+			clock_remove (f);
+			ksm_forget (f);
+			evict_cnt++;
+			return f;
+		}
+	}
+	return NULL;
+}
+
+/* Puts FRAME, a victim whose page could not be evicted, back on the
+ * clock as a hot frame.  The caller must hold the frame table lock. */
+void
+frame_table_keep (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (!frame->linked);
+
+	ghost_take (frame);
+	evict_cnt--;
+	frame->hot = true;
+	frame->test = false;
+	frame->fresh = false;
+	clock_insert (frame);
+}
+
+/* Makes FRAME, whose page is not expected to be used again soon, the
+ * next frame the cold hand visits, cold, out of its test period and
+ * unreferenced, so that it is the next victim.  The caller must hold
+ * the frame table lock. */
+void
+frame_table_deactivate (struct frame *frame) {
+	struct page *page = frame->page;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (!frame->linked)
+		return;
+	clock_remove (frame);
+	frame->hot = false;
+	frame->test = false;
+	frame->fresh = false;
+	frame->accessed = false;
+	if (page != NULL && page->owner->pml4 != NULL)
+		pml4_set_accessed (page->owner->pml4, page->va, false);
+	clock_insert (frame);
+	hand_cold = &frame->clock_elem;
+	deactivate_cnt++;
+}
+
+/* Puts FRAME, split off the huge page that HEAD starts, on the clock,
+ * hot or cold like HEAD, which decided for the whole huge page so far.
+ * The caller must hold the frame table lock. */
+void
+frame_table_add_split (struct frame *frame, const struct frame *head) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (!frame->linked);
+
+	frame->hot = head->hot;
+	frame->test = head->test;
+	frame->fresh = false;
+	frame->accessed = head->accessed;
+	frame->idle_age = head->idle_age;
+	clock_insert (frame);
+}
+
+/* Calls FUNC on up to CNT frames, going around the clock from where
+ * the previous call stopped, with the frame table lock held.  FUNC may
+ * remove the frame it is given from the frame table.  Returns true if
+ * the scan went past the end of the clock. */
+bool
+frame_table_scan (size_t cnt, frame_scan_func *func, void *aux) {
+	bool wrapped = false;
+
+	lock_acquire (&frame_lock);
+	if (hand_scan == NULL && !list_empty (&clock))
+		hand_scan = list_begin (&clock);
+	while (cnt-- > 0 && hand_scan != NULL) {
+		struct frame *f = list_entry (hand_scan, struct frame, clock_elem);
+
+		hand_scan = list_next (hand_scan);
+		if (hand_scan == list_end (&clock)) {
+			hand_scan = list_begin (&clock);
+			wrapped = true;
+		}
+		func (f, aux);
+	}
+	lock_release (&frame_lock);
+	return wrapped;
+}
+
+/* Calls FUNC on every frame on the clock.  The caller must hold the
+ * frame table lock, and FUNC must not remove frames. */
+void
+frame_table_for_each (frame_scan_func *func, void *aux) {
+	struct list_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	for (e = list_begin (&clock); e != list_end (&clock); e = list_next (e))
+		func (list_entry (e, struct frame, clock_elem), aux);
+}
+
+/* Pins FRAME, so that it is not evicted until unpinned.  Pins nest. */
+void
+frame_pin (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	frame->pin_cnt++;
+	lock_release (&frame_lock);
+}
+
+void
+frame_unpin (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->pin_cnt > 0);
+	frame->pin_cnt--;
+	lock_release (&frame_lock);
+}
+
+void
+frame_table_print_stats (void) {
+	printf ("Frames: %zu resident (%zu hot), %zu ghosts, %lld hits, "
+			"%lld evictions, %lld refaults, %lld deactivated\n",
+			frame_cnt, hot_cnt, ghost_cnt, hit_cnt, evict_cnt, refault_cnt,
+			deactivate_cnt);
+}
+
+/* Hash function and comparison for ghosts. */
+static uint64_t
+ghost_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct ghost *g = hash_entry (e, struct ghost, hash_elem);
+	return hash_bytes (&g->tid, sizeof g->tid)
+		^ hash_bytes (&g->va, sizeof g->va);
+}
+
+static bool
+ghost_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct ghost *a = hash_entry (a_, struct ghost, hash_elem);
+	const struct ghost *b = hash_entry (b_, struct ghost, hash_elem);
+
+	if (a->tid != b->tid)
+		return a->tid < b->tid;
+	return a->va < b->va;
+}
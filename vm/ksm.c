@@ -0,0 +1,239 @@
+/* ksm.c: Same-page merging of anonymous memory.
+ *
+ * A kernel thread, ksmd, wakes up every KSM_SLEEP_MS milliseconds and
+ * hashes the contents of the next ksm_pages_to_scan frames on the
+ * clock.  Anonymous frames with equal contents are merged into one
+ * frame, shared read-only by all of their pages, exactly like a frame
+ * shared by fork(): the first write to any of them takes the
+ * write-protect fault and gets a private copy again.
+ *
+ * Two tables, both keyed by content hash, remember what was seen:
+ *
+ *   - The stable table holds merged frames.  They are read-only, so
+ *     their contents cannot change while they are in it.  A frame
+ *     leaves it when it is freed, evicted, or made writable again.
+ *
+ *   - The unstable table holds candidates: frames whose contents did
+ *     not change between two visits of ksmd.  They are still writable,
+ *     so an entry may be stale; every match is checked with memcmp()
+ *     before merging.  The table is emptied after every full pass.
+ *
+ * A frame whose hash changes between two visits is being written and
+ * is not worth merging, so it is not entered anywhere.
+ *
+ * ksmd may be preempted at any time, and the owner of a writable page
+ * may then write it.  So a page is write-protected, and its dirty bit
+ * cleared, before it is compared: a write that slipped in before the
+ * protection shows in the dirty bit and calls the merge off.
+ *
+ * Merging is off unless enabled with the -ksm option.
+ *
+ * Everything here is protected by the frame table lock. */
+
+#include "vm/ksm.h"
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/vm.h"
+
+/* Pause between two batches of ksmd. */
+#define KSM_SLEEP_MS 20
+
+int ksm_pages_to_scan = 0;
+
+static struct hash stable;            /* Merged frames. */
+static struct hash unstable;          /* Candidates of this pass. */
+
+/* Statistics. */
+static long long scan_cnt;            /* Frames visited. */
+static long long merge_cnt;           /* Frames freed by merging. */
+static long long pass_cnt;            /* Passes over the whole clock. */
+
+static uint64_t ksm_hash (const struct hash_elem *, void *);
+static bool ksm_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+static void ksmd (void *aux);
+
+void
+ksm_init (void) {
+	if (!hash_init (&stable, ksm_hash, ksm_less, NULL)
+			|| !hash_init (&unstable, ksm_hash, ksm_less, NULL))
+		PANIC ("ksm_init: out of memory");
+	if (ksm_pages_to_scan > 0)
+		thread_create ("ksmd", PRI_MIN, ksmd, NULL);
+}
+
+/* Removes FRAME from the stable or unstable table, if it is in one.
+ * Called when FRAME is about to change or go away.  The caller must
+ * hold the frame table lock. */
+void
+ksm_forget (struct frame *frame) {
+	if (frame->ksm_stable)
+		hash_delete (&stable, &frame->ksm_elem);
+	else if (frame->ksm_unstable)
+		hash_delete (&unstable, &frame->ksm_elem);
+	frame->ksm_stable = frame->ksm_unstable = false;
+}
+
+/* Returns the frame in TABLE whose contents hash to SUM, or a null
+ * pointer. */
+static struct frame *
+ksm_find (struct hash *table, uint64_t sum) {
+	struct frame key;
+	struct hash_elem *e;
+
+	key.ksm_sum = sum;
+	e = hash_find (table, &key.ksm_elem);
+	return e != NULL ? hash_entry (e, struct frame, ksm_elem) : NULL;
+}
+
+/* Returns whether FRAME holds an anonymous page that may be merged
+ * now, i.e. one that is not shared, pinned, part of a huge page,
+ * lazily freed, whose dirty bit counts, or being torn down. */
+static bool
+mergeable (struct frame *frame) {
+	struct page *page = frame->page;
+
+	return page != NULL && frame->map_cnt == 1 && frame->pin_cnt == 0
+		&& frame->huge == NULL
+		&& VM_TYPE (page->operations->type) == VM_ANON
+		&& !page->anon.lazy_free
+		&& page->owner->pml4 != NULL;
+}
+
+/* Write-protects the page in FRAME, a mergeable frame, and clears its
+ * dirty bit. */
+static void
+ksm_protect (struct frame *frame) {
+	struct page *page = frame->page;
+
+	pml4_set_dirty (page->owner->pml4, page->va, false);
+	pml4_protect_range (page->owner->pml4, page->va, page->va + PGSIZE,
+			false);
+}
+
+/* Returns whether the page in FRAME was written since ksm_protect(). */
+static bool
+ksm_written (struct frame *frame) {
+	struct page *page = frame->page;
+
+	return pml4_is_dirty (page->owner->pml4, page->va);
+}
+
+/* Undoes ksm_protect() on FRAME, which is not merged after all. */
+static void
+ksm_unprotect (struct frame *frame) {
+	struct page *page = frame->page;
+
+	if (page->writable)
+		pml4_protect_range (page->owner->pml4, page->va, page->va + PGSIZE,
+				true);
+}
+
+/* Visits FRAME on behalf of ksmd. */
+static void
+scan_frame (struct frame *frame, void *aux UNUSED) {
+	struct frame *twin;
+	uint64_t sum;
+	bool changed;
+
+	scan_cnt++;
+	if (frame->ksm_stable || !mergeable (frame))
+		return;
+	sum = hash_bytes (frame->kva, PGSIZE);
+
+	/* Join a merged frame with the same contents.  TWIN is read-only
+	 * already. */
+	twin = ksm_find (&stable, sum);
+	if (twin != NULL) {
+		ksm_protect (frame);
+		if (!memcmp (twin->kva, frame->kva, PGSIZE) && !ksm_written (frame)) {
+			ksm_forget (frame);
+			vm_merge_frame (frame, twin);
+			merge_cnt++;
+			return;
+		}
+		ksm_unprotect (frame);
+	}
+
+	/* Already a candidate with the same contents: wait for a twin. */
+	if (frame->ksm_unstable && frame->ksm_sum == sum)
+		return;
+	ksm_forget (frame);
+	changed = frame->ksm_sum != sum;
+	frame->ksm_sum = sum;
+	if (changed)
+		return;
+
+	twin = ksm_find (&unstable, sum);
+	if (twin == NULL) {
+		hash_insert (&unstable, &frame->ksm_elem);
+		frame->ksm_unstable = true;
+		return;
+	}
+	if (!mergeable (twin))
+		return;
+
+	/* Both pages become read-only in one frame, TWIN, which turns
+	 * stable.  Protect both before comparing them. */
+	ksm_protect (twin);
+	ksm_protect (frame);
+	if (memcmp (twin->kva, frame->kva, PGSIZE)
+			|| ksm_written (twin) || ksm_written (frame)) {
+		ksm_unprotect (twin);
+		ksm_unprotect (frame);
+		return;
+	}
+	ksm_forget (twin);
+	twin->ksm_sum = sum;
+	/* On a hash collision with another merged frame, TWIN stays
+	 * merged but cannot be found. */
+	twin->ksm_stable = hash_insert (&stable, &twin->ksm_elem) == NULL;
+	vm_merge_frame (frame, twin);
+	merge_cnt++;
+}
+
+/* Forgets a candidate at the end of a pass. */
+static void
+unstable_clear (struct hash_elem *e, void *aux UNUSED) {
+	hash_entry (e, struct frame, ksm_elem)->ksm_unstable = false;
+}
+
+/* The merging daemon. */
+static void
+ksmd (void *aux UNUSED) {
+	for (;;) {
+		if (frame_table_scan (ksm_pages_to_scan, scan_frame, NULL)) {
+			frame_table_lock ();
+			hash_clear (&unstable, unstable_clear);
+			pass_cnt++;
+			frame_table_unlock ();
+		}
+		timer_msleep (KSM_SLEEP_MS);
+	}
+}
+
+void
+ksm_print_stats (void) {
+	printf ("KSM: %zu merged frames, %lld frames freed, %lld scanned in "
+			"%lld passes\n", hash_size (&stable), merge_cnt, scan_cnt,
+			pass_cnt);
+}
+
+/* Hash function and comparison for frames, by contents. */
+static uint64_t
+ksm_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct frame, ksm_elem)->ksm_sum;
+}
+
+static bool
+ksm_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct frame, ksm_elem)->ksm_sum
+		< hash_entry (b, struct frame, ksm_elem)->ksm_sum;
+}
@@ -0,0 +1,172 @@
+/* rss.c: Resident set accounting, limits and working-set estimation.
+ *
+ * A process's RSS is the number of its pages that are mapped to a
+ * frame; a frame shared by several processes counts for each.  Each
+ * process has a soft and a hard RSS limit, unlimited by default,
+ * inherited across fork() and set with the rss_limit() system call.
+ *
+ *   - A process above its soft limit, or holding many more pages than
+ *     its working set, is "over".  While any process is over, the cold
+ *     hand passes over the frames of the others on its first rounds,
+ *     so reclaim takes from the processes over first.
+ *
+ *   - A process at its hard limit does not grow: each new frame it
+ *     needs is taken from one of its own pages.
+ *
+ * The working set is estimated by sampling accessed bits.  Every
+ * WSS_PERIOD_MS milliseconds a thread sweeps the frame table, moving
+ * each frame's accessed bit into the frame, where the clock hands
+ * still find it.  A page referenced within the last WSS_WINDOW sweeps
+ * is in its owner's working set.
+ *
+ * All of this is protected by the frame table lock. */
+
+#include "vm/rss.h"
+#include <stdint.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "vm/frame.h"
+#include "vm/vm.h"
+
+#define WSS_PERIOD_MS 250             /* Time between two sweeps. */
+#define WSS_WINDOW 4                  /* Working set window, in sweeps. */
+
+static size_t over_cnt;               /* Processes over. */
+
+/* Statistics. */
+static long long sweep_cnt;           /* Working set sweeps. */
+
+static void wss_sampler (void *aux);
+
+void
+rss_init (void) {
+	thread_create ("wss", PRI_DEFAULT, wss_sampler, NULL);
+}
+
+/* Recomputes whether T is over, after one of its numbers changed. */
+static void
+rss_update (struct thread *t) {
+	bool over = t->rss > t->rss_soft
+		|| (t->rss > t->wss && t->rss - t->wss > t->rss / 8);
+
+	if (over != t->rss_over) {
+		t->rss_over = over;
+		if (over)
+			over_cnt++;
+		else
+			over_cnt--;
+	}
+}
+
+/* Counts one more page of T as resident. */
+void
+rss_charge (struct thread *t) {
+	t->rss++;
+	rss_update (t);
+}
+
+/* Counts one page of T less as resident. */
+void
+rss_uncharge (struct thread *t) {
+	ASSERT (t->rss > 0);
+	t->rss--;
+	rss_update (t);
+}
+
+/* Returns whether T is above its soft limit or its working set. */
+bool
+rss_over (const struct thread *t) {
+	return t->rss_over;
+}
+
+/* Returns whether any process is over. */
+bool
+rss_any_over (void) {
+	return over_cnt > 0;
+}
+
+/* Returns whether T may not get any more frames. */
+bool
+rss_at_hard_limit (const struct thread *t) {
+	return t->rss >= t->rss_hard;
+}
+
+/* Sets the RSS limits of the current process to SOFT and HARD pages,
+ * where 0 means no limit.  Returns false if SOFT is above HARD. */
+bool
+rss_set_limit (size_t soft, size_t hard) {
+	struct thread *t = thread_current ();
+
+	if (soft == 0)
+		soft = SIZE_MAX;
+	if (hard == 0)
+		hard = SIZE_MAX;
+	if (soft > hard)
+		return false;
+	frame_table_lock ();
+	t->rss_soft = soft;
+	t->rss_hard = hard;
+	rss_update (t);
+	frame_table_unlock ();
+	return true;
+}
+
+/* Gives CHILD, a new process, the limits of PARENT. */
+void
+rss_inherit (struct thread *child, const struct thread *parent) {
+	child->rss_soft = parent->rss_soft;
+	child->rss_hard = parent->rss_hard;
+}
+
+/* Samples the accessed bit of FRAME and counts it in its owner's
+ * working set if it was referenced recently. */
+static void
+sample_frame (struct frame *frame, void *aux UNUSED) {
+	struct page *page = frame->page;
+	uint64_t *pml4;
+
+	if (page == NULL || (pml4 = page->owner->pml4) == NULL)
+		return;
+	if (pml4_is_accessed (pml4, page->va)) {
+		pml4_set_accessed (pml4, page->va, false);
+		frame->accessed = true;
+		frame->idle_age = 0;
+	} else if (frame->idle_age < UINT8_MAX)
+		frame->idle_age++;
+	if (frame->idle_age < WSS_WINDOW)
+		page->owner->wss_acc++;
+}
+
+/* Publishes the working set that the last sweep counted for T. */
+static void
+commit_wss (struct thread *t, void *aux UNUSED) {
+	t->wss = t->wss_acc;
+	t->wss_acc = 0;
+	rss_update (t);
+}
+
+/* The working set sampler. */
+static void
+wss_sampler (void *aux UNUSED) {
+	for (;;) {
+		enum intr_level old_level;
+
+		timer_msleep (WSS_PERIOD_MS);
+		frame_table_lock ();
+		frame_table_for_each (sample_frame, NULL);
+		old_level = intr_disable ();
+		thread_foreach (commit_wss, NULL);
+		intr_set_level (old_level);
+		sweep_cnt++;
+		frame_table_unlock ();
+	}
+}
+
+void
+rss_print_stats (void) {
+	printf ("RSS: %zu processes over limit or working set, %lld working "
+			"set sweeps\n", over_cnt, sweep_cnt);
+}
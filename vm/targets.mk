@@ -1,5 +1,12 @@
 vm_SRC = vm/vm.c          # Main api proxy
+vm_SRC += vm/area.c       # Virtual memory areas
+vm_SRC += vm/frame.c      # Frame table and page replacement
 vm_SRC += vm/uninit.c     # Uninitialized page
 vm_SRC += vm/anon.c       # Anonymous page
+vm_SRC += vm/zswap.c      # Compressed swap cache
+vm_SRC += vm/ksm.c        # Same-page merging
+vm_SRC += vm/rss.c        # Resident set limits
+vm_SRC += vm/fault.c      # Page fault statistics
 vm_SRC += vm/file.c       # File mapped page
+vm_SRC += vm/filemap.c    # Page cache of file pages
 vm_SRC += vm/inspect.c    # Testing utility
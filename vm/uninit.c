@@ -8,6 +8,7 @@
  * function.
  * */
 
+#include "threads/mmu.h"
 #include "vm/vm.h"
 #include "vm/uninit.h"
 
@@ -63,6 +64,10 @@ uninit_initialize (struct page *page, void *kva) {
 static void
 uninit_destroy (struct page *page) {
 	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	/* An uninit page has no frame yet, and the AUX of an area's page is
+	 * the area itself, which outlives the page.  The page may still be
+	 * mapped to the shared zero page, which must not be freed along
+	 * with the page table. */
+	if (page->owner->pml4 != NULL)
+		pml4_clear_page (page->owner->pml4, page->va);
 }
@@ -1,8 +1,95 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <mman.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "intrinsic.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
+#include "vm/fault.h"
+#include "vm/filemap.h"
+#include "vm/frame.h"
 #include "vm/inspect.h"
+#include "vm/ksm.h"
+#include "vm/rss.h"
+
+/* Largest fault-around window, in pages. */
+#define FAULT_AROUND_MAX 16
+
+/* mmap() places mappings that come without an address below here,
+ * top-down, leaving room for the stack to grow.  The heap grows up
+ * towards them. */
+#define MMAP_TOP ((uint8_t *) USER_STACK - (8 << 20))
+
+/* Unmapped pages kept between the stack and the area below it. */
+#define STACK_GUARD_PAGES 16
+
+/* Largest stack limit: the stack may not reach down into the room
+ * mmap() takes from. */
+#define STACK_LIMIT_MAX ((size_t) ((uint8_t *) USER_STACK - MMAP_TOP) \
+		- STACK_GUARD_PAGES * PGSIZE)
+
+/* Pages the stack grows by at once, loaded ahead of use if memory
+ * allows.  Set with the -stack-chunk kernel option. */
+int stack_chunk_pages = 8;
+
+/* Pages mapped by fault-around. */
+static long long fault_around_cnt;
+
+/* Stack growth statistics. */
+static long long stack_grow_cnt;      /* Faults that grew the stack. */
+static long long stack_ahead_cnt;     /* Pages loaded ahead of use. */
+
+/* A page of zeros, mapped read-only for reads of anonymous pages that
+ * were never written. */
+static void *zero_page;
+
+/* Read faults served by ZERO_PAGE. */
+static long long zero_map_cnt;
+
+/* Pages in a huge page. */
+#define HUGE_PAGES (LARGE_PGSIZE / PGSIZE)
+
+/* A 2 MiB run of an anonymous area mapped by a single PDE.  Its pages
+ * have HUGE_PAGES physically contiguous frames, one each, as usual.
+ * Only HEAD, the frame of the first page, is on the clock, where it
+ * stands for the whole run; the others wait on TAILS, linked through
+ * their clock elements.  The run is split back into 4 kB mappings
+ * before any one of its pages is evicted, unmapped or shared. */
+struct huge_page {
+	struct frame *head;           /* Frame of the first page. */
+	struct list tails;            /* Frames of the other pages. */
+	void *pt;                     /* Page table set aside for the split. */
+};
+
+/* Huge page statistics. */
+static long long huge_try_cnt;        /* Write faults that could go huge. */
+static long long huge_map_cnt;        /* Runs mapped huge. */
+static long long huge_split_cnt;      /* Runs split again. */
+
+/* Free user frame watermarks.  Below LOW, kswapd is woken and reclaims
+ * until HIGH; below MIN, faults also reclaim by themselves. */
+static size_t wmark_min, wmark_low, wmark_high;
+
+static struct semaphore kswapd_sema;  /* Upped to wake kswapd. */
+static bool kswapd_running;           /* Awake, or about to be? */
+
+/* Reclaim statistics. */
+static long long kswapd_wakeup_cnt;   /* Times kswapd was woken. */
+static long long kswapd_reclaim_cnt;  /* Frames freed by kswapd. */
+static long long direct_reclaim_cnt;  /* Frames evicted by faults. */
+static long long hard_reclaim_cnt;    /* Frames recycled at a hard limit. */
+
+/* Advice statistics. */
+static long long prefetch_cnt;        /* Pages loaded by WILLNEED, populate. */
+static long long dontneed_cnt;        /* Pages dropped by DONTNEED. */
+static long long lazy_drop_cnt;       /* Lazily freed pages dropped. */
+
+static void kswapd (void *aux);
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,7 +102,54 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	frame_table_init ();
+	filemap_init ();
+	fault_init ();
+	ksm_init ();
+	rss_init ();
+	zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+
+	/* 1/32, 1/16 and 1/8 of user memory. */
+	wmark_min = palloc_user_free () / 32 + 1;
+	wmark_low = 2 * wmark_min;
+	wmark_high = 4 * wmark_min;
+	sema_init (&kswapd_sema, 0);
+	kswapd_running = true;
+	thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL);
+}
+
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+	fault_print_stats ();
+	printf ("Fault-around: %lld pages mapped\n", fault_around_cnt);
+	printf ("Zero page: %lld read faults served\n", zero_map_cnt);
+	printf ("Stack: grown %lld times, %lld pages loaded ahead\n",
+			stack_grow_cnt, stack_ahead_cnt);
+	printf ("Huge pages: %lld of %lld eligible faults mapped 2 MiB, "
+			"%lld split\n", huge_map_cnt, huge_try_cnt, huge_split_cnt);
+	printf ("Advice: %lld pages prefetched, %lld dropped, %lld lazily "
+			"freed pages dropped\n", prefetch_cnt, dontneed_cnt, lazy_drop_cnt);
+	printf ("Reclaim: watermarks %zu/%zu/%zu, kswapd woken %lld times, "
+			"%lld frames by kswapd, %lld by direct reclaim, %lld at RSS "
+			"limits\n", wmark_min, wmark_low, wmark_high, kswapd_wakeup_cnt,
+			kswapd_reclaim_cnt, direct_reclaim_cnt, hard_reclaim_cnt);
+	frame_table_print_stats ();
+	filemap_print_stats ();
+	file_print_stats ();
+	anon_print_stats ();
+	ksm_print_stats ();
+	rss_print_stats ();
+}
+
+/* Returns the process whose address space the current thread runs
+ * in: itself, or the parent it borrows the address space of since
+ * vfork(). */
+struct thread *
+vm_owner (void) {
+	struct thread *t = thread_current ();
+
+	return t->vfork_parent != NULL ? t->vfork_parent : t;
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -33,9 +167,29 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
-static struct frame *vm_get_victim (void);
+static struct frame *vm_get_victim (struct thread *owner);
+static void huge_split (struct huge_page *huge);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static bool claim_page (struct page *page, bool evict);
+static bool load_page (struct page *page, bool evict);
+static struct frame *vm_evict_frame (struct thread *owner);
+static struct page *area_get_page (struct vm_area *area, void *va);
+static void fault_around (struct vm_area *area, void *va);
+static bool page_is_cacheable (struct page *page, struct inode **inode,
+		size_t *index);
+
+/* Returns the page initializer for pages of TYPE. */
+static bool
+(*type_initializer (enum vm_type type)) (struct page *, enum vm_type, void *) {
+	switch (VM_TYPE (type)) {
+		case VM_ANON:
+			return anon_initializer;
+		case VM_FILE:
+			return file_backed_initializer;
+		default:
+			PANIC ("unexpected vm type %d", type);
+	}
+}
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -46,15 +200,24 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
-	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		struct page *page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, pg_round_down (upage), init, type, aux,
+				type_initializer (type));
+		page->area = NULL;
+		page->owner = vm_owner ();
+		page->writable = writable;
 
-		/* TODO: Insert the page into the spt. */
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,82 +225,1044 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page key;
+	struct hash_elem *e;
 
-	return page;
+	if (!spt->active)
+		return NULL;
+	key.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &key.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt,
+		struct page *page) {
+	ASSERT (pg_ofs (page->va) == 0);
 
-	return succ;
+	if (!spt->active || !is_user_vaddr (page->va))
+		return false;
+	if (hash_insert (&spt->pages, &page->spt_elem) != NULL)
+		return false;
+	if (page->area != NULL)
+		list_push_back (&page->area->pages, &page->area_elem);
+	return true;
 }
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	hash_delete (&spt->pages, &page->spt_elem);
+	if (page->area != NULL)
+		list_remove (&page->area_elem);
 	vm_dealloc_page (page);
-	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Adds to SPT an area covering [START, END) whose pages have the
+ * given TYPE and WRITABLE bit.  On first touch, a page is filled by
+ * INIT, which receives the area as AUX, or zero-filled if INIT is
+ * null.  FILE, if nonnull, is reopened; the area reads READ_BYTES
+ * bytes of it starting at OFFSET.  Returns a null pointer if the
+ * range overlaps an existing area or memory allocation fails. */
+struct vm_area *
+vm_area_add (struct supplemental_page_table *spt, void *start, void *end,
+		enum vm_type type, bool writable, vm_initializer *init,
+		struct file *file, off_t offset, size_t read_bytes) {
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT (start < end);
+	ASSERT (VM_TYPE (type) == VM_ANON || VM_TYPE (type) == VM_FILE);
+
+	struct vm_area *area = malloc (sizeof *area);
+	if (area == NULL)
+		return NULL;
+	*area = (struct vm_area) {
+		.start = start,
+		.end = end,
+		.type = type,
+		.writable = writable,
+		.init = init,
+		.offset = offset,
+		.read_bytes = read_bytes,
+		.fault_window = FAULT_AROUND_MAX,
+		.advice = MADV_NORMAL,
+	};
+	list_init (&area->pages);
+	if (file != NULL && (area->file = file_reopen (file)) == NULL) {
+		free (area);
+		return NULL;
+	}
+	if (!spt_insert_area (spt, area)) {
+		file_close (area->file);
+		free (area);
+		return NULL;
+	}
+	return area;
+}
+
+/* Destroys every page of AREA, removes AREA from SPT and frees it.
+ * The modified pages of a file mapping are written back first, in
+ * runs.  The whole area is unmapped with one page table walk and one
+ * TLB flush, so that freeing the pages one by one has no
+ * invalidations left to do. */
+void
+vm_area_destroy (struct supplemental_page_table *spt, struct vm_area *area) {
+	if (VM_TYPE (area->type) == VM_FILE)
+		file_sync (area, area->start, area->end);
+	if (!list_empty (&area->pages)) {
+		struct page *page = list_entry (list_front (&area->pages),
+				struct page, area_elem);
+
+		if (page->owner->pml4 != NULL)
+			pml4_unmap_range (page->owner->pml4, area->start, area->end);
+	}
+	while (!list_empty (&area->pages)) {
+		struct page *page = list_entry (list_front (&area->pages),
+				struct page, area_elem);
+		spt_remove_page (spt, page);
+	}
+	spt_remove_area (spt, area);
+	file_close (area->file);
+	free (area);
+}
+
+/* Returns how many bytes of the page at VA in AREA come from the
+ * area's file and stores their file offset into *OFS.  The rest of
+ * the page is zero-filled. */
+size_t
+vm_area_read_bytes (const struct vm_area *area, const void *va, off_t *ofs) {
+	size_t page_ofs = (uint8_t *) pg_round_down (va) - (uint8_t *) area->start;
+
+	*ofs = area->offset + page_ofs;
+	if (page_ofs >= area->read_bytes)
+		return 0;
+	return area->read_bytes - page_ofs < PGSIZE
+		? area->read_bytes - page_ofs : PGSIZE;
+}
+
+/* Returns the page of AREA at VA, creating it as an uninit page of
+ * the area if it has not been touched yet.  Returns a null pointer
+ * if memory allocation fails. */
+static struct page *
+area_get_page (struct vm_area *area, void *va) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	struct page *page = spt_find_page (spt, va);
+
+	if (page != NULL)
+		return page;
+	page = malloc (sizeof *page);
+	if (page == NULL)
+		return NULL;
+	uninit_new (page, pg_round_down (va), area->init, area->type, area,
+			type_initializer (area->type));
+	page->area = area;
+	page->owner = vm_owner ();
+	page->writable = area->writable;
+	if (!spt_insert_page (spt, page)) {
+		free (page);
+		return NULL;
+	}
+	return page;
+}
+
+/* Returns a new frame for KVA, or a null pointer if out of memory. */
 static struct frame *
-vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+frame_create (void *kva) {
+	struct frame *frame = calloc (1, sizeof *frame);
+
+	if (frame != NULL) {
+		frame->kva = kva;
+		list_init (&frame->pages);
+	}
+	return frame;
+}
+
+/* Maps PAGE to FRAME, which other pages may already share. */
+static void
+frame_link (struct frame *frame, struct page *page) {
+	list_push_back (&frame->pages, &page->frame_elem);
+	frame->map_cnt++;
+	rss_charge (page->owner);
+	frame->page = list_entry (list_front (&frame->pages), struct page,
+			frame_elem);
+	page->frame = frame;
+}
 
-	return victim;
+/* Unmaps PAGE from its frame. */
+static void
+frame_unlink (struct page *page) {
+	struct frame *frame = page->frame;
+
+	list_remove (&page->frame_elem);
+	frame->map_cnt--;
+	rss_uncharge (page->owner);
+	frame->page = frame->map_cnt > 0
+		? list_entry (list_front (&frame->pages), struct page, frame_elem)
+		: NULL;
+	page->frame = NULL;
+}
+
+/* Get the struct frame, that will be evicted: one of OWNER's, if
+ * OWNER is nonnull.  The frame table lock must be held. */
+static struct frame *
+vm_get_victim (struct thread *owner) {
+	return frame_table_victim (owner);
 }
 
-/* Evict one page and return the corresponding frame.
+/* Unmaps every page in FRAME, so that none of them can modify it
+ * while it is being written out, and marks them clean.  Returns
+ * whether any of them was modified.  The caller must hold the frame
+ * table lock. */
+static bool
+frame_unmap (struct frame *frame) {
+	struct list_elem *e;
+	bool dirty = false;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		if (pml4 != NULL) {
+			dirty |= pml4_is_dirty (pml4, page->va);
+			pml4_clear_page (pml4, page->va);
+			pml4_set_dirty (pml4, page->va, false);
+		}
+	}
+	return dirty;
+}
+
+/* Maps every page in FRAME, whose eviction failed, again.  A frame
+ * shared copy-on-write stays read-only. */
+static void
+frame_remap (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		bool writable = page->writable && (frame->map_cnt == 1
+				|| VM_TYPE (page->operations->type) == VM_FILE);
+
+		if (page->owner->pml4 != NULL)
+			pml4_set_page (page->owner->pml4, page->va, frame->kva, writable);
+	}
+}
+
+/* Returns whether FRAME, an anonymous frame, may be dropped without
+ * a copy: every page in it was lazily freed, and not written since.
+ * Clears their lazy_free bits either way.  DIRTY says whether any of
+ * them was written. */
+static bool
+frame_lazy_drop (struct frame *frame, bool dirty) {
+	struct list_elem *e;
+	bool drop = !dirty;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		drop &= page->anon.lazy_free;
+		page->anon.lazy_free = false;
+	}
+	return drop;
+}
+
+/* Ends the eviction of FRAME: if OK, takes every page off it, which
+ * then has no frame, and out of the page cache, and returns true;
+ * otherwise maps its pages again, puts it back on the clock and
+ * returns false.  A frame that lost all of its pages meanwhile is
+ * evicted anyway.  The caller must hold the frame table lock. */
+static bool
+evict_finish (struct frame *frame, bool ok) {
+	if (frame->evicting) {
+		frame->evicting = false;
+		frame->pin_cnt--;
+	}
+	if (!ok && frame->map_cnt > 0) {
+		frame_remap (frame);
+		frame_table_keep (frame);
+		return false;
+	}
+	while (frame->map_cnt > 0)
+		frame_unlink (frame->page);
+	filemap_remove (frame);
+	return true;
+}
+
+/* A modified file frame being written back by reclaim_frames(). */
+struct file_evict {
+	struct frame *frame;          /* The frame. */
+	struct file *file;            /* Own handle to the file, */
+	off_t offset;                 /*   where the page goes, */
+	size_t read_bytes;            /*   and how much of it. */
+};
+
+/* The batches of reclaim_frames(), too big for a kernel stack, which
+ * shares its page with struct thread.  One reclaim fills them at a
+ * time: RECLAIM_BUSY, under the frame table lock, says that one is
+ * under way, and the others wait in frame_table_wait(). */
+static struct anon_evict reclaim_anon[SWAP_CLUSTER];
+static struct file_evict reclaim_files[SWAP_CLUSTER];
+static struct frame *reclaim_freed[SWAP_CLUSTER];
+static bool reclaim_busy;
+
+/* Evicts up to SWAP_CLUSTER frames at once, so that their anonymous
+ * pages reach swap in one burst; only frames mapped by pages of OWNER,
+ * if OWNER is nonnull.  A frame shared by several pages is evicted
+ * once, for all of them.  Lazily freed anonymous pages that were not
+ * written since are dropped instead of swapped.  If KEEP is nonnull,
+ * one of the freed frames is stored into *KEEP, or a null pointer if
+ * none was freed; the others go back to the user pool.  Returns the
+ * number of frames freed.
+ *
+ * The frame table lock is released during the I/O.  The victims are
+ * unmapped, pinned and marked as evicting meanwhile, and anyone who
+ * needs one of them waits in frame_table_wait() until it is gone or
+ * back.  So does anyone else who wants to reclaim. */
+static size_t
+reclaim_frames (struct thread *owner, struct frame **keep) {
+	struct anon_evict *anon = reclaim_anon;
+	struct file_evict *files = reclaim_files;
+	struct frame **freed = reclaim_freed;
+	size_t anon_cnt = 0, file_cnt = 0, freed_cnt = 0, taken, i;
+	bool anon_ok = true;
+
+	frame_table_lock ();
+	while (reclaim_busy)
+		frame_table_wait ();
+	reclaim_busy = true;
+	for (taken = 0; taken < SWAP_CLUSTER; taken++) {
+		struct frame *victim = vm_get_victim (owner);
+		struct page *page;
+		bool dirty;
+
+		if (victim == NULL)
+			break;
+		/* The rest of a huge page goes back on the clock, 4 kB at a
+		 * time, for the hands to judge. */
+		if (victim->huge != NULL)
+			huge_split (victim->huge);
+		page = victim->page;
+		/* An idle page cache frame needs no writing out. */
+		if (page == NULL) {
+			evict_finish (victim, true);
+			freed[freed_cnt++] = victim;
+			continue;
+		}
+		dirty = frame_unmap (victim);
+		if (VM_TYPE (page->operations->type) == VM_ANON) {
+			if (frame_lazy_drop (victim, dirty)) {
+				evict_finish (victim, true);
+				freed[freed_cnt++] = victim;
+				lazy_drop_cnt++;
+				continue;
+			}
+			anon_evict_init (&anon[anon_cnt++], victim);
+		} else if (dirty) {
+			struct file_evict *fe = &files[file_cnt];
+
+			fe->file = file_reopen (page->file.file);
+			if (fe->file == NULL) {
+				evict_finish (victim, false);
+				pml4_set_dirty (page->owner->pml4, page->va, true);
+				continue;
+			}
+			fe->frame = victim;
+			fe->offset = page->file.offset;
+			fe->read_bytes = page->file.read_bytes;
+			file_cnt++;
+		} else {
+			/* A clean file page reads back from the file. */
+			evict_finish (victim, true);
+			freed[freed_cnt++] = victim;
+			continue;
+		}
+		victim->evicting = true;
+		victim->pin_cnt++;
+	}
+	frame_table_unlock ();
+
+	if (anon_cnt > 0)
+		anon_ok = anon_swap_out_cluster (anon, anon_cnt);
+	for (i = 0; i < file_cnt; i++) {
+		file_write_at (files[i].file, files[i].frame->kva,
+				files[i].read_bytes, files[i].offset);
+		file_close (files[i].file);
+	}
+
+	frame_table_lock ();
+	for (i = 0; i < anon_cnt; i++) {
+		if (anon_ok)
+			anon_evict_attach (&anon[i]);
+		if (evict_finish (anon[i].frame, anon_ok))
+			freed[freed_cnt++] = anon[i].frame;
+	}
+	for (i = 0; i < file_cnt; i++)
+		if (evict_finish (files[i].frame, true))
+			freed[freed_cnt++] = files[i].frame;
+
+	for (i = 0; i < freed_cnt; i++)
+		if (keep != NULL && i == 0)
+			*keep = freed[i];
+		else {
+			palloc_free_page (freed[i]->kva);
+			free (freed[i]);
+		}
+	if (keep != NULL && freed_cnt == 0)
+		*keep = NULL;
+	reclaim_busy = false;
+	frame_table_wake ();
+	frame_table_unlock ();
+	return freed_cnt;
+}
+
+/* Returns the frame of PAGE, or a null pointer if it has none, once
+ * no eviction of it is in progress.  The caller must hold the frame
+ * table lock, which may be released while waiting. */
+struct frame *
+vm_page_frame (struct page *page) {
+	while (page->frame != NULL && page->frame->evicting)
+		frame_table_wait ();
+	return page->frame;
+}
+
+/* Evict pages, of OWNER if nonnull, and return one of the freed
+ * frames.
  * Return NULL on error.*/
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+vm_evict_frame (struct thread *owner) {
+	struct frame *frame;
 
-	return NULL;
+	reclaim_frames (owner, &frame);
+	return frame;
+}
+
+/* Wakes kswapd up, unless it is already running. */
+static void
+kswapd_wake (void) {
+	if (!kswapd_running) {
+		kswapd_running = true;
+		kswapd_wakeup_cnt++;
+		sema_up (&kswapd_sema);
+	}
+}
+
+/* The reclaim daemon.  Woken when the free user frames drop below
+ * the low watermark, it evicts in batches until they are back above
+ * the high watermark, so that faults rarely have to evict
+ * themselves. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		while (palloc_user_free () < wmark_high) {
+			size_t freed_cnt = reclaim_frames (NULL, NULL);
+			if (freed_cnt == 0)
+				break;
+			kswapd_reclaim_cnt += freed_cnt;
+		}
+		kswapd_running = false;
+		sema_down (&kswapd_sema);
+	}
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  Returns a null pointer only if the user pool is full
+ * and no page can be evicted, or, if EVICT is false, just if the user
+ * pool is full.
+ * If ZERO is true, the frame is returned zero-filled.
+ * Eviction is normally left to kswapd, which is woken below the low
+ * watermark; the faulting thread only evicts by itself below the min
+ * watermark, or when the pool is empty.  A process at its hard RSS
+ * limit gets a frame only by evicting one of its own pages. */
 static struct frame *
-vm_get_frame (void) {
+vm_get_frame (bool zero, bool evict) {
+	struct thread *cur = vm_owner ();
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	size_t free_cnt = palloc_user_free ();
+	void *kva;
+
+	if (free_cnt < wmark_low)
+		kswapd_wake ();
+	if (rss_at_hard_limit (cur)) {
+		if (!evict)
+			return NULL;
+		frame = vm_evict_frame (cur);
+		if (frame != NULL)
+			hard_reclaim_cnt++;
+	}
+	if (frame == NULL && evict && free_cnt <= wmark_min) {
+		frame = vm_evict_frame (NULL);
+		if (frame != NULL)
+			direct_reclaim_cnt++;
+	}
+
+	if (frame == NULL) {
+		kva = palloc_get_page (PAL_USER | (zero ? PAL_ZERO : 0));
+		if (kva != NULL) {
+			frame = frame_create (kva);
+			if (frame == NULL)
+				PANIC ("vm_get_frame: out of kernel memory");
+			zero = false;
+		} else {
+			frame = evict ? vm_evict_frame (NULL) : NULL;
+			if (frame == NULL)
+				return NULL;
+			direct_reclaim_cnt++;
+		}
+	}
+	if (zero)
+		memset (frame->kva, 0, PGSIZE);
 
-	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 	return frame;
 }
 
-/* Growing the stack. */
+/* Returns a frame for a page read ahead of a fault, or a null
+ * pointer if the free frames are below the low watermark or the
+ * current process is at its hard RSS limit.  Read-ahead is a guess,
+ * so it never evicts, nor makes kswapd do so. */
+struct frame *
+vm_readahead_frame (void) {
+	if (palloc_user_free () < wmark_low)
+		return NULL;
+	return vm_get_frame (false, false);
+}
+
+/* Frees FRAME, from vm_readahead_frame(), which was not needed. */
+void
+vm_readahead_release (struct frame *frame) {
+	palloc_free_page (frame->kva);
+	free (frame);
+}
+
+/* Makes FRAME, from vm_readahead_frame(), which already holds the
+ * contents of PAGE, the frame of PAGE, as if PAGE had just been
+ * claimed.  Returns false, freeing FRAME, if memory allocation
+ * fails. */
+bool
+vm_install_page (struct page *page, struct frame *frame) {
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		vm_readahead_release (frame);
+		return false;
+	}
+	frame_table_lock ();
+	frame_link (frame, page);
+	frame_table_unlock ();
+	frame_table_insert (frame);
+	return true;
+}
+
+/* Moves every page of DUP onto FRAME, whose contents are the same,
+ * mapped read-only, and frees DUP.  A later write to one of the pages
+ * copies it out again through vm_handle_wp().  The caller must hold
+ * the frame table lock. */
+void
+vm_merge_frame (struct frame *dup, struct frame *frame) {
+	ASSERT (dup != frame);
+
+	while (dup->map_cnt > 0) {
+		struct page *page = dup->page;
+		uint64_t *pml4 = page->owner->pml4;
+
+		frame_unlink (page);
+		frame_link (frame, page);
+		/* Clearing first flushes the old translation from the TLB. */
+		pml4_clear_page (pml4, page->va);
+		if (!pml4_set_page (pml4, page->va, frame->kva, false))
+			PANIC ("vm_merge_frame: page table lost");
+	}
+	frame_table_remove (dup);
+	palloc_free_page (dup->kva);
+	free (dup);
+}
+
+/* Unmaps PAGE from its owner's page table and from its frame, if it
+ * has one, and frees the frame unless other pages still share it or
+ * it stays in the page cache. */
+void
+vm_free_frame (struct page *page) {
+	struct frame *frame;
+	bool last = false;
+
+	/* An eviction in progress may take the frame away from PAGE. */
+	frame_table_lock ();
+	frame = page->frame;
+	if (frame != NULL) {
+		if (frame->huge != NULL)
+			huge_split (frame->huge);
+		frame_unlink (page);
+		/* A frame under eviction is freed by its evicter. */
+		last = frame->map_cnt == 0 && frame->mapping == NULL
+			&& frame->pin_cnt == 0;
+		if (last)
+			frame_table_remove (frame);
+	}
+	frame_table_unlock ();
+
+	/* Without a frame, PAGE may still map the zero page. */
+	if (page->owner->pml4 != NULL)
+		pml4_clear_page (page->owner->pml4, page->va);
+	if (frame == NULL)
+		return;
+	if (last) {
+		palloc_free_page (frame->kva);
+		free (frame);
+	}
+}
+
+/* Splits HUGE back into 4 kB mappings, using the page table it set
+ * aside, and puts its tail frames on the clock.  The caller must hold
+ * the frame table lock. */
+static void
+huge_split (struct huge_page *huge) {
+	struct frame *head = huge->head;
+	struct page *page = head->page;
+
+	if (page->owner->pml4 != NULL)
+		pml4_split_large (page->owner->pml4, page->va, huge->pt);
+	else
+		palloc_free_page (huge->pt);
+	while (!list_empty (&huge->tails)) {
+		struct frame *frame = list_entry (list_pop_front (&huge->tails),
+				struct frame, clock_elem);
+
+		frame->huge = NULL;
+		frame_table_add_split (frame, head);
+	}
+	head->huge = NULL;
+	free (huge);
+	huge_split_cnt++;
+}
+
+/* Undoes the first CNT pages of a huge_fault() at BASE: unlinks them
+ * from their frames, which are freed, so that they are faulted in again
+ * one by one. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+huge_unwind (uint8_t *base, size_t cnt) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	size_t i;
+
+	frame_table_lock ();
+	for (i = 0; i < cnt; i++) {
+		struct page *page = spt_find_page (spt, base + i * PGSIZE);
+		struct frame *frame = page->frame;
+
+		frame_unlink (page);
+		free (frame);
+	}
+	frame_table_unlock ();
+}
+
+/* Tries to serve a write fault at VA, in AREA, on a page that was never
+ * touched, by mapping the whole aligned 2 MiB run around VA with one
+ * huge page.  That needs an anonymous, writable area of zero-fill
+ * pages covering the run, none of whose pages exist yet, a free
+ * aligned run of frames, memory well above the reclaim watermarks and
+ * room under the RSS limits.  Returns false, having changed nothing
+ * visible, otherwise. */
+static bool
+huge_fault (struct vm_area *area, void *va) {
+	struct thread *owner = vm_owner ();
+	uint8_t *base = (uint8_t *) ((uintptr_t) va & ~(LARGE_PGSIZE - 1));
+	struct huge_page *huge;
+	uint8_t *kva = NULL, *p;
+	void *old_pt;
+	size_t i = 0;
+	off_t ofs;
+
+	if (VM_TYPE (area->type) != VM_ANON || !area->writable
+			|| (area->type & VM_STACK) || base < (uint8_t *) area->start
+			|| base + LARGE_PGSIZE > (uint8_t *) area->end
+			|| vm_area_read_bytes (area, base, &ofs) > 0)
+		return false;
+	huge_try_cnt++;
+	if (palloc_user_free () < wmark_high + HUGE_PAGES || rss_over (owner)
+			|| owner->rss + HUGE_PAGES > owner->rss_hard)
+		return false;
+	for (p = base; p < base + LARGE_PGSIZE; p += PGSIZE)
+		if (spt_find_page (&owner->spt, p) != NULL)
+			return false;
+
+	huge = malloc (sizeof *huge);
+	if (huge == NULL)
+		return false;
+	list_init (&huge->tails);
+	huge->pt = palloc_get_page (PAL_ZERO);
+	if (huge->pt == NULL)
+		goto fail;
+	kva = palloc_get_aligned (PAL_USER | PAL_ZERO, HUGE_PAGES, HUGE_PAGES);
+	if (kva == NULL)
+		goto fail;
+
+	/* Give every page its frame, still off the clock. */
+	for (i = 0; i < HUGE_PAGES; i++) {
+		struct page *page = area_get_page (area, base + i * PGSIZE);
+		struct frame *frame;
+
+		if (page == NULL
+				|| (frame = frame_create (kva + i * PGSIZE)) == NULL)
+			goto fail;
+		frame->huge = huge;
+		frame_table_lock ();
+		frame_link (frame, page);
+		frame_table_unlock ();
+		if (!swap_in (page, frame->kva)) {
+			/* Leave it to be loaded again like any other page. */
+			huge_unwind (base + i * PGSIZE, 1);
+			goto fail;
+		}
+		if (i == 0)
+			huge->head = frame;
+		else
+			list_push_back (&huge->tails, &frame->clock_elem);
+	}
+	if (!pml4_map_large (owner->pml4, base, kva, true, &old_pt))
+		goto fail;
+	palloc_free_page (old_pt);
+
+	frame_table_insert (huge->head);
+	huge_map_cnt++;
+	return true;
+
+fail:
+	huge_unwind (base, i);
+	palloc_free_multiple (kva, HUGE_PAGES);
+	palloc_free_page (huge->pt);
+	free (huge);
+	return false;
+}
+
+/* Grows the stack of the current process down to cover ADDR, if that
+ * keeps it within its limit and STACK_GUARD_PAGES away from the area
+ * below.  It grows by stack_chunk_pages pages at least, where there is
+ * room, and the new pages other than ADDR's are loaded right away while
+ * frames are free, so that a deep descent does not fault on each page.
+ * Returns true if ADDR is now in the stack. */
+static bool
+vm_stack_growth (void *addr) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	struct vm_area *stack = spt_find_area (spt, (uint8_t *) USER_STACK - 1);
+	uint8_t *limit = (uint8_t *) USER_STACK - spt->stack_limit;
+	uint8_t *page_va = pg_round_down (addr), *start, *old_start, *p;
+	size_t chunk = stack_chunk_pages > 0 ? stack_chunk_pages : 1;
+
+	if (stack == NULL || !(stack->type & VM_STACK)
+			|| page_va >= (uint8_t *) stack->start || page_va < limit)
+		return false;
+	old_start = stack->start;
+	start = (size_t) (old_start - page_va) >= chunk * PGSIZE
+		? page_va : old_start - chunk * PGSIZE;
+	if (start < limit)
+		start = limit;
+
+	/* Keep the guard gap, giving up the chunk before ADDR itself. */
+	if (spt_find_overlap (spt, start - STACK_GUARD_PAGES * PGSIZE,
+				old_start) != NULL) {
+		start = page_va;
+		if (spt_find_overlap (spt, start - STACK_GUARD_PAGES * PGSIZE,
+					old_start) != NULL)
+			return false;
+	}
+
+	/* Areas are ordered by start, so move the stack's. */
+	spt_remove_area (spt, stack);
+	stack->start = start;
+	if (!spt_insert_area (spt, stack))
+		NOT_REACHED ();
+	stack_grow_cnt++;
+
+	for (p = start; p < old_start; p += PGSIZE) {
+		struct page *page;
+
+		if (p == page_va)
+			continue;
+		if (palloc_user_free () <= wmark_low
+				|| (page = area_get_page (stack, p)) == NULL
+				|| !claim_page (page, false))
+			break;
+		stack_ahead_cnt++;
+	}
+	return true;
+}
+
+/* Sets the stack limit of the current process to LIMIT bytes, rounded
+ * up to whole pages.  Fails if the stack is already larger, or LIMIT
+ * exceeds STACK_LIMIT_MAX. */
+bool
+vm_set_stack_limit (size_t limit) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	struct vm_area *stack = spt_find_area (spt, (uint8_t *) USER_STACK - 1);
+
+	if (limit > STACK_LIMIT_MAX)
+		return false;
+	limit = ROUND_UP (limit, PGSIZE);
+	if (stack != NULL && (stack->type & VM_STACK)
+			&& (size_t) ((uint8_t *) USER_STACK
+				- (uint8_t *) stack->start) > limit)
+		return false;
+	spt->stack_limit = limit;
+	return true;
+}
+
+/* Handle the fault on write_protected page: the first write to a
+ * copy-on-write page.  PAGE gets a private copy of its frame, unless
+ * no other page shares the frame any more, in which case PAGE just
+ * takes it back.  A page with no frame at all is mapped to the zero
+ * page and gets its first frame now. */
+static bool
+vm_handle_wp (struct page *page) {
+	uint64_t *pml4 = page->owner->pml4;
+	struct frame *frame, *copy = NULL;
+
+	frame_table_lock ();
+	frame = vm_page_frame (page);
+	if (frame != NULL && frame->map_cnt > 1) {
+		/* Finding a frame may evict, which takes the frame table lock. */
+		frame_table_unlock ();
+		copy = vm_get_frame (false, true);
+		if (copy == NULL)
+			return false;
+		frame_table_lock ();
+	}
+
+	/* The sharers may have gone away, or PAGE may have been evicted,
+	 * while we waited for a frame. */
+	frame = vm_page_frame (page);
+	if (frame == NULL) {
+		frame_table_unlock ();
+		if (copy != NULL) {
+			palloc_free_page (copy->kva);
+			free (copy);
+		}
+		return vm_do_claim_page (page);
+	}
+	if (frame->map_cnt == 1) {
+		/* Its contents are about to change. */
+		ksm_forget (frame);
+		frame_table_unlock ();
+		if (copy != NULL) {
+			palloc_free_page (copy->kva);
+			free (copy);
+		}
+		pml4_protect_range (pml4, page->va, page->va + PGSIZE, true);
+		return true;
+	}
+
+	memcpy (copy->kva, frame->kva, PGSIZE);
+	frame_unlink (page);
+	frame_link (copy, page);
+	frame_table_unlock ();
+
+	if (!pml4_set_page (pml4, page->va, copy->kva, true)) {
+		vm_free_frame (page);
+		return false;
+	}
+	frame_table_insert (copy);
+	return true;
 }
 
-/* Handle the fault on write_protected page */
+/* Returns true if PAGE has no frame and would be loaded with nothing
+ * but zeros: it was never loaded, or it is an anonymous page that was
+ * evicted as a page of zeros or dropped. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+page_is_zero_fill (struct page *page) {
+	struct uninit_page *uninit = &page->uninit;
+	off_t ofs;
+
+	if (page->frame != NULL)
+		return false;
+	if (VM_TYPE (page->operations->type) == VM_ANON)
+		return anon_is_zero (page);
+	if (VM_TYPE (page->operations->type) != VM_UNINIT
+			|| VM_TYPE (uninit->type) != VM_ANON)
+		return false;
+	if (uninit->init == NULL)
+		return true;
+	/* The zero tail of a program segment. */
+	return page->area != NULL && uninit->init == page->area->init
+		&& vm_area_read_bytes (page->area, page->va, &ofs) == 0;
+}
+
+/* Maps the shared zero page read-only at PAGE, which must be zero
+ * fill.  The first write to PAGE then takes the write-protect path,
+ * which gives it a frame of its own. */
+static bool
+map_zero_page (struct page *page) {
+	ASSERT (page_is_zero_fill (page));
+
+	if (!pml4_set_page (page->owner->pml4, page->va, zero_page, false))
+		return false;
+	zero_map_cnt++;
+	return true;
+}
+
+/* Pushes the frames of the pages in [START, END), which a sequential
+ * reader has left behind, to the cold hand, so that they go before the
+ * pages of other processes. */
+static void
+deactivate_range (uint8_t *start, uint8_t *end) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	uint8_t *p;
+
+	frame_table_lock ();
+	for (p = start; p < end; p += PGSIZE) {
+		struct page *page = spt_find_page (spt, p);
+
+		if (page != NULL && page->frame != NULL && page->frame->map_cnt == 1)
+			frame_table_deactivate (page->frame);
+	}
+	frame_table_unlock ();
+}
+
+/* Adapts the fault-around window of AREA to a read fault at VA, then
+ * maps the untouched pages of the window around VA whose contents are
+ * already in the page cache, as far as free frames last.  The window
+ * stops at the first page that would have to be read from its file.
+ * Runs of sequential faults, as when a program starts running its
+ * text, widen the window; scattered faults narrow it again.  Under
+ * MADV_SEQUENTIAL the largest window is read ahead of VA instead, from
+ * the file if need be, as the program asked, and the window behind VA
+ * is deactivated; under MADV_RANDOM nothing is mapped around the
+ * fault. */
+static void
+fault_around (struct vm_area *area, void *va) {
+	size_t window = area->fault_window;
+	uint8_t *start, *end, *p;
+	struct inode *inode;
+	size_t index;
+
+	if (area->advice == MADV_RANDOM)
+		return;
+	if (area->advice == MADV_SEQUENTIAL) {
+		window = FAULT_AROUND_MAX;
+		start = va;
+		if ((size_t) ((uint8_t *) va - (uint8_t *) area->start)
+				> window * PGSIZE)
+			deactivate_range (start - window * PGSIZE, va);
+		else
+			deactivate_range (area->start, va);
+	} else {
+		if (area->last_fault != NULL) {
+			size_t dist = (uint8_t *) va > (uint8_t *) area->last_fault
+				? (uint8_t *) va - (uint8_t *) area->last_fault
+				: (uint8_t *) area->last_fault - (uint8_t *) va;
+			if (dist <= 2 * window * PGSIZE)
+				window = window * 2 < FAULT_AROUND_MAX
+					? window * 2 : FAULT_AROUND_MAX;
+			else
+				window = window / 2 > 1 ? window / 2 : 1;
+		}
+		area->fault_window = window;
+		area->last_fault = va;
+		if (window == 1)
+			return;
+
+		/* The window is aligned to its size within the area. */
+		start = (uint8_t *) area->start
+			+ ((uint8_t *) va - (uint8_t *) area->start) / (window * PGSIZE)
+			* (window * PGSIZE);
+	}
+	end = start + window * PGSIZE;
+	if (end > (uint8_t *) area->end)
+		end = area->end;
+
+	for (p = start; p < end; p += PGSIZE) {
+		struct page *page;
+
+		if (p == va)
+			continue;
+		page = area_get_page (area, p);
+		if (page == NULL)
+			break;
+		if (page->frame != NULL
+				|| VM_TYPE (page->operations->type) != VM_UNINIT
+				|| page_is_zero_fill (page))
+			continue;
+		if (area->advice != MADV_SEQUENTIAL
+				&& !(page_is_cacheable (page, &inode, &index)
+					&& filemap_contains (inode, index)))
+			break;
+		if (!claim_page (page, false))
+			break;
+		fault_around_cnt++;
+	}
+}
+
+/* Returns how a fault on PAGE will be served, a write to a present
+ * page if NOT_PRESENT is false. */
+static enum fault_kind
+classify_fault (struct page *page, bool not_present) {
+	struct inode *inode;
+	size_t index;
+
+	if (page->frame != NULL)
+		return not_present ? FAULT_RESIDENT : FAULT_COW;
+	if (page_is_zero_fill (page))
+		return FAULT_ZERO;
+	if (page_is_cacheable (page, &inode, &index)
+			&& filemap_contains (inode, index))
+		return FAULT_RESIDENT;
+	if (VM_TYPE (page->operations->type) == VM_ANON)
+		return page->anon.slot != SWAP_NONE || page->anon.zentry != NULL
+			? FAULT_SWAP : FAULT_ZERO;
+	return FAULT_FILE;
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	uint64_t start = rdtsc ();
 	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+	enum fault_kind kind;
+	bool ok;
 
-	return vm_do_claim_page (page);
+	/* Validate the fault: it must hit a user page of a process. */
+	if (addr == NULL || !is_user_vaddr (addr) || !spt->active)
+		return false;
+
+	page = spt_find_page (spt, addr);
+	if (page == NULL) {
+		struct vm_area *area = spt_find_area (spt, addr);
+
+		/* Below the stack pointer, only the 128-byte red zone of the
+		 * System V ABI may be touched.  A fault in the kernel, while it
+		 * accesses user memory in a system call, is checked against
+		 * the user's stack pointer at the time of the call. */
+		uintptr_t rsp = user ? f->rsp : thread_current ()->user_rsp;
+		if (area == NULL && (uintptr_t) addr >= rsp - 128
+				&& vm_stack_growth (addr))
+			area = spt_find_area (spt, addr);
+		if (area == NULL)
+			return false;
+		if (write && huge_fault (area, addr)) {
+			fault_record (FAULT_ZERO, VM_ANON, f->rip, rdtsc () - start);
+			return true;
+		}
+		page = area_get_page (area, addr);
+		if (page == NULL)
+			return false;
+	}
+
+	if (write && !page->writable)
+		return false;
+
+	kind = classify_fault (page, not_present);
+	if (!not_present)
+		ok = vm_handle_wp (page);
+	else if (!write && page_is_zero_fill (page))
+		ok = map_zero_page (page);
+	else {
+		ok = vm_do_claim_page (page);
+		if (ok && !write && page->area != NULL && page->area->file != NULL)
+			fault_around (page->area, page->va);
+	}
+	if (ok)
+		fault_record (kind, page_get_type (page), f->rip, rdtsc () - start);
+	return ok;
 }
 
 /* Free the page.
@@ -150,41 +1275,587 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	struct page *page = spt_find_page (spt, va);
+
+	if (page == NULL) {
+		struct vm_area *area = spt_find_area (spt, va);
+		if (area == NULL || (page = area_get_page (area, va)) == NULL)
+			return false;
+	}
+	if (page->frame != NULL)
+		return true;
 
 	return vm_do_claim_page (page);
 }
 
+/* Loads the pages of AREA in [START, END) that are not resident,
+ * stopping at the first that cannot get a frame.  If EVICT is false,
+ * only free frames are used, and pages of zeros are left to the zero
+ * page. */
+static void
+area_prefetch (struct vm_area *area, uint8_t *start, uint8_t *end,
+		bool evict) {
+	uint8_t *p;
+
+	for (p = start; p < end; p += PGSIZE) {
+		struct page *page = area_get_page (area, p);
+
+		if (page == NULL)
+			break;
+		if (page->frame != NULL || (!evict && page_is_zero_fill (page)))
+			continue;
+		if (!claim_page (page, evict))
+			break;
+		prefetch_cnt++;
+	}
+}
+
+/* Destroys the pages of AREA in [START, END), writing back those of a
+ * file mapping first.  The next touch brings them back like pages that
+ * were never touched, from the file or as zeros. */
+static void
+area_drop (struct vm_area *area, uint8_t *start, uint8_t *end) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	struct list_elem *e = list_begin (&area->pages);
+
+	while (e != list_end (&area->pages)) {
+		struct page *page = list_entry (e, struct page, area_elem);
+
+		e = list_next (e);
+		if ((uint8_t *) page->va >= start && (uint8_t *) page->va < end) {
+			spt_remove_page (spt, page);
+			dontneed_cnt++;
+		}
+	}
+}
+
+/* Lets reclaim drop the anonymous pages of AREA in [START, END)
+ * instead of swapping them out, unless they are written again first,
+ * and moves their frames to the cold hand.  Copies already swapped out
+ * are freed at once.  Areas backed by a file are left alone. */
+static void
+area_lazy_free (struct vm_area *area, uint8_t *start, uint8_t *end) {
+	struct list_elem *e;
+
+	if (area->file != NULL)
+		return;
+	frame_table_lock ();
+	for (e = list_begin (&area->pages); e != list_end (&area->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, area_elem);
+		struct frame *frame;
+
+		if ((uint8_t *) page->va < start || (uint8_t *) page->va >= end
+				|| VM_TYPE (page->operations->type) != VM_ANON)
+			continue;
+		frame = vm_page_frame (page);
+		if (frame != NULL && frame->huge != NULL)
+			huge_split (frame->huge);
+		if (frame == NULL)
+			anon_discard (page);
+		else if (frame->map_cnt == 1) {
+			/* A write from now on sets the dirty bit again. */
+			pml4_set_dirty (page->owner->pml4, page->va, false);
+			page->anon.lazy_free = true;
+			frame_table_deactivate (frame);
+		}
+	}
+	frame_table_unlock ();
+}
+
+/* Loads every page of AREA, a new mapping made with MAP_POPULATE, as
+ * far as memory allows. */
+void
+vm_populate (struct vm_area *area) {
+	area_prefetch (area, area->start, area->end, true);
+}
+
+/* Applies ADVICE, one of the MADV_* values, to [ADDR, ADDR + LENGTH)
+ * in the current process.  MADV_NORMAL, MADV_RANDOM and
+ * MADV_SEQUENTIAL describe the access pattern of whole areas and apply
+ * to every area the range touches; the others act on the pages of the
+ * range right away.  Returns false if ADDR is not page-aligned, ADVICE
+ * is unknown, or part of the range is not mapped. */
+bool
+vm_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	uint8_t *start = addr, *end = start + ROUND_UP (length, PGSIZE), *p;
+	struct vm_area *area;
+
+	if (pg_ofs (addr) != 0 || advice < MADV_NORMAL || advice > MADV_FREE
+			|| end < start || (end > start && !is_user_vaddr (end - 1)))
+		return false;
+	for (p = start; p < end; p = area->end)
+		if ((area = spt_find_area (spt, p)) == NULL)
+			return false;
+
+	for (p = start; p < end; p = area->end) {
+		uint8_t *stop;
+
+		area = spt_find_area (spt, p);
+		stop = end < (uint8_t *) area->end ? end : (uint8_t *) area->end;
+		switch (advice) {
+			case MADV_NORMAL:
+			case MADV_RANDOM:
+			case MADV_SEQUENTIAL:
+				area->advice = advice;
+				break;
+			case MADV_WILLNEED:
+				area_prefetch (area, p, stop, false);
+				break;
+			case MADV_DONTNEED:
+				area_drop (area, p, stop);
+				break;
+			case MADV_FREE:
+				area_lazy_free (area, p, stop);
+				break;
+		}
+	}
+	return true;
+}
+
+/* Writes the modified pages of the file mappings in [ADDR, ADDR +
+ * LENGTH) of the current process back to their files.  FLAGS is
+ * MS_SYNC, to write them now, or MS_ASYNC, to leave them to be written
+ * when they are evicted or unmapped, which happens anyway; pages of
+ * anonymous areas in the range are left alone either way.  Returns
+ * false if ADDR is not page-aligned, FLAGS is invalid, or part of the
+ * range is not mapped. */
+bool
+vm_msync (void *addr, size_t length, int flags) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	uint8_t *start = addr, *end = start + ROUND_UP (length, PGSIZE), *p;
+	struct vm_area *area;
+
+	if (pg_ofs (addr) != 0 || (flags != MS_SYNC && flags != MS_ASYNC)
+			|| end < start || (end > start && !is_user_vaddr (end - 1)))
+		return false;
+	for (p = start; p < end; p = area->end)
+		if ((area = spt_find_area (spt, p)) == NULL)
+			return false;
+	if (flags == MS_ASYNC)
+		return true;
+
+	for (p = start; p < end; p = area->end) {
+		area = spt_find_area (spt, p);
+		if (VM_TYPE (area->type) == VM_FILE)
+			file_sync (area, p, end < (uint8_t *) area->end
+					? end : (uint8_t *) area->end);
+	}
+	return true;
+}
+
+/* Starts the heap of the current process, empty, at BASE, a page
+ * above the program's segments. */
+void
+vm_heap_init (void *base) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+
+	ASSERT (pg_ofs (base) == 0);
+	spt->heap_start = spt->brk = base;
+}
+
+/* Moves the program break of the current process by INCREMENT bytes
+ * and returns its old value, or SBRK_FAILED if the heap would shrink
+ * below its start or run into another area.  The heap is one VM_HEAP
+ * area over the pages the break reaches into, if any; its pages are
+ * zero-filled on first touch like any anonymous memory, and those the
+ * break retreats from are freed. */
+void *
+vm_sbrk (intptr_t increment) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	uint8_t *old_brk = spt->brk, *new_brk = old_brk + increment;
+	uint8_t *old_end = pg_round_up (old_brk), *new_end;
+	struct vm_area *area;
+
+	if (spt->heap_start == NULL)
+		return SBRK_FAILED;
+	if ((increment > 0 && new_brk < old_brk)
+			|| (increment < 0 && new_brk > old_brk)
+			|| new_brk < spt->heap_start || new_brk > MMAP_TOP)
+		return SBRK_FAILED;
+	new_end = pg_round_up (new_brk);
+	area = old_end > spt->heap_start
+		? spt_find_area (spt, spt->heap_start) : NULL;
+
+	if (new_end > old_end) {
+		/* Areas are ordered by start, so the heap may simply grow
+		 * into the gap above it. */
+		if (spt_find_overlap (spt, old_end, new_end) != NULL)
+			return SBRK_FAILED;
+		if (area != NULL)
+			area->end = new_end;
+		else if (vm_area_add (spt, spt->heap_start, new_end,
+					VM_ANON | VM_HEAP, true, NULL, NULL, 0, 0) == NULL)
+			return SBRK_FAILED;
+	} else if (new_end < old_end) {
+		area_drop (area, new_end, old_end);
+		if (new_end == spt->heap_start)
+			vm_area_destroy (spt, area);
+		else
+			area->end = new_end;
+	}
+	spt->brk = new_brk;
+	return old_brk;
+}
+
+/* Returns the highest page-aligned address below MMAP_TOP, and above
+ * the heap, where LENGTH bytes fit without overlapping an area of the
+ * current process, or a null pointer if there is none. */
+void *
+vm_find_unmapped (size_t length) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	uint8_t *floor = spt->brk != NULL ? pg_round_up (spt->brk) : NULL;
+	uint8_t *end = MMAP_TOP;
+
+	length = ROUND_UP (length, PGSIZE);
+	if (floor == NULL)
+		floor = (uint8_t *) PGSIZE;
+	while (length > 0 && (size_t) (end - floor) >= length) {
+		struct vm_area *area = spt_find_overlap (spt, end - length, end);
+
+		/* No fit can reach above the lowest area in the way. */
+		if (area == NULL)
+			return end - length;
+		end = area->start;
+		if (end < floor)
+			break;
+	}
+	return NULL;
+}
+
+/* Returns whether the SIZE bytes at UADDR all lie in areas of the
+ * current process, writable ones if WRITE is true, so that the kernel
+ * may access them on its behalf. */
+bool
+vm_user_range_ok (const void *uaddr, size_t size, bool write) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	const uint8_t *p = pg_round_down (uaddr);
+	const uint8_t *end = (const uint8_t *) uaddr + size;
+	struct vm_area *area;
+
+	if (end < (const uint8_t *) uaddr
+			|| (size > 0 && !is_user_vaddr (end - 1)))
+		return false;
+	for (; p < end; p = area->end) {
+		area = spt_find_area (spt, p);
+		/* A buffer on the stack may reach below the pages touched
+		 * so far, as far as a fault in user mode could grow it. */
+		if (area == NULL) {
+			const void *addr = p > (const uint8_t *) uaddr ? p : uaddr;
+
+			if ((uintptr_t) addr >= thread_current ()->user_rsp - 128
+					&& vm_stack_growth ((void *) addr))
+				area = spt_find_area (spt, p);
+		}
+		if (area == NULL || (write && !area->writable))
+			return false;
+	}
+	return true;
+}
+
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	return claim_page (page, true);
+}
+
+/* Returns whether PAGE, once loaded, holds exactly its page of the
+ * file, so that it may share the frame of that file page with other
+ * mappings through the page cache.  If so, stores the file's inode and
+ * the page number into *INODE and *INDEX. */
+static bool
+page_is_cacheable (struct page *page, struct inode **inode, size_t *index) {
+	struct vm_area *area = page->area;
+	size_t read_bytes;
+	off_t ofs;
+
+	if (area == NULL || area->file == NULL || VM_TYPE (area->type) != VM_FILE)
+		return false;
+	read_bytes = vm_area_read_bytes (area, page->va, &ofs);
+	if (read_bytes < PGSIZE
+			&& ofs + (off_t) read_bytes != file_length (area->file))
+		return false;
+	*inode = file_get_inode (area->file);
+	*index = ofs / PGSIZE;
+	return true;
+}
+
+/* Claims PAGE, a file page, through the page cache: maps the cached
+ * frame of its file page if there is one, and otherwise loads PAGE
+ * and caches its frame. */
+static bool
+claim_cached_page (struct page *page, struct inode *inode, size_t index,
+		bool evict) {
+	struct frame *frame;
+
+	frame_table_lock ();
+	while ((frame = filemap_find (inode, index)) != NULL && frame->evicting)
+		frame_table_wait ();
+	if (frame != NULL) {
+		if ((VM_TYPE (page->operations->type) == VM_UNINIT
+					&& !page->uninit.page_initializer (page, page->uninit.type,
+						NULL))
+				|| !pml4_set_page (page->owner->pml4, page->va, frame->kva,
+					page->writable)) {
+			frame_table_unlock ();
+			return false;
+		}
+		frame_link (frame, page);
+		frame_table_unlock ();
+		return true;
+	}
+	frame_table_unlock ();
+
+	if (!load_page (page, evict))
+		return false;
+	/* Another process may have cached the same page meanwhile, in which
+	 * case this frame stays private; and the frame may already be
+	 * gone again. */
+	frame_table_lock ();
+	if (page->frame != NULL)
+		filemap_add (inode, index, page->frame);
+	frame_table_unlock ();
+	return true;
+}
+
+/* Claims PAGE like vm_do_claim_page(), but if EVICT is false, only
+ * if a frame is free. */
+static bool
+claim_page (struct page *page, bool evict) {
+	struct frame *frame;
+	struct inode *inode;
+	size_t index;
+
+	/* An eviction of PAGE in progress may yet fail and map it again. */
+	frame_table_lock ();
+	frame = vm_page_frame (page);
+	frame_table_unlock ();
+	if (frame != NULL)
+		return true;
+
+	if (page_is_cacheable (page, &inode, &index))
+		return claim_cached_page (page, inode, index, evict);
+	return load_page (page, evict);
+}
+
+/* Loads PAGE into a new frame of its own. */
+static bool
+load_page (struct page *page, bool evict) {
+	/* Let the allocator hand out an already zeroed frame for a page of
+	 * zeros. */
+	bool zero = page_is_zero_fill (page);
+	struct frame *frame = vm_get_frame (zero, evict);
+
+	if (frame == NULL)
+		return false;
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	frame_table_lock ();
+	frame_link (frame, page);
+	frame_table_unlock ();
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)
+			|| !swap_in (page, frame->kva)) {
+		vm_free_frame (page);
+		return false;
+	}
 
-	return swap_in (page, frame->kva);
+	/* Only now that it is loaded may the frame be chosen for eviction. */
+	frame_table_insert (frame);
+	return true;
+}
+
+/* Hash function and comparison for the pages of an SPT. */
+static uint64_t
+page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *page = hash_entry (e, struct page, spt_elem);
+	return hash_bytes (&page->va, sizeof page->va);
+}
+
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct page, spt_elem)->va
+		< hash_entry (b, struct page, spt_elem)->va;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	spt->areas = NULL;
+	spt->heap_start = spt->brk = NULL;
+	spt->stack_limit = STACK_LIMIT_DEFAULT;
+	spt->active = hash_init (&spt->pages, page_hash, page_less, NULL);
+}
+
+/* Copies the area SRC_AREA into the SPT of the current thread, given
+ * as AUX.  Pages of the parent are duplicated by
+ * supplemental_page_table_copy() afterwards; those of a writable
+ * anonymous area are about to be shared copy-on-write, so the parent's
+ * mappings of the area are all made read-only here, with one page
+ * table walk. */
+static bool
+copy_area (struct vm_area *src_area, void *aux) {
+	struct supplemental_page_table *dst = aux;
+	struct vm_area *area = vm_area_add (dst, src_area->start, src_area->end,
+			src_area->type, src_area->writable, src_area->init, src_area->file,
+			src_area->offset, src_area->read_bytes);
+
+	if (area == NULL)
+		return false;
+	area->advice = src_area->advice;
+	if (VM_TYPE (src_area->type) == VM_ANON && src_area->writable
+			&& !list_empty (&src_area->pages)) {
+		struct page *page = list_entry (list_front (&src_area->pages),
+				struct page, area_elem);
+
+		pml4_protect_range (page->owner->pml4, src_area->start, src_area->end,
+				false);
+	}
+	return true;
+}
+
+/* Makes PAGE, a new uninit page of the current thread, share the
+ * frame of SRC_PAGE, an anonymous page of the parent, copy-on-write.
+ * Both are mapped read-only until one of them is written.  The parent's
+ * pages in areas were write-protected by copy_area() already.  If
+ * SRC_PAGE is swapped out, PAGE shares its swap slot instead, so that
+ * forking under memory pressure reads nothing back in. */
+static bool
+share_page (struct page *page, struct page *src_page) {
+	uint64_t *src_pml4 = src_page->owner->pml4;
+	bool protect = src_page->area == NULL;
+	struct frame *frame;
+
+	ASSERT (VM_TYPE (page->operations->type) == VM_UNINIT);
+	if (!page->uninit.page_initializer (page, page->uninit.type, NULL))
+		return false;
+
+	frame_table_lock ();
+	while ((frame = vm_page_frame (src_page)) == NULL) {
+		if (anon_share (page, src_page)) {
+			frame_table_unlock ();
+			return true;
+		}
+		/* Compressed in zswap: bring it back first, which maps it
+		 * writable again. */
+		frame_table_unlock ();
+		if (!vm_do_claim_page (src_page))
+			return false;
+		protect = true;
+		frame_table_lock ();
+	}
+	if (frame->huge != NULL)
+		huge_split (frame->huge);
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva, false)) {
+		frame_table_unlock ();
+		return false;
+	}
+	frame_link (frame, page);
+	if (protect && src_page->writable)
+		pml4_protect_range (src_pml4, src_page->va, src_page->va + PGSIZE,
+				false);
+	frame_table_unlock ();
+	return true;
+}
+
+/* Duplicates SRC_PAGE of the parent into the SPT of the current
+ * thread.  Anonymous pages are shared copy-on-write; file-backed
+ * pages, whose writes go back to the file, are copied. */
+static bool
+copy_page (struct supplemental_page_table *dst, struct page *src_page) {
+	struct frame *frame;
+	struct page *page;
+	bool ok;
+
+	if (src_page->area != NULL) {
+		/* Untouched pages of an area need no copy at all: the child's
+		 * area recreates them on demand. */
+		if (src_page->frame == NULL
+				&& VM_TYPE (src_page->operations->type) == VM_UNINIT)
+			return true;
+		page = area_get_page (spt_find_area (dst, src_page->va),
+				src_page->va);
+		/* The contents come from the parent, not from the area. */
+		if (page != NULL)
+			page->uninit.init = NULL;
+	} else if (VM_TYPE (src_page->operations->type) == VM_UNINIT) {
+		/* A standalone lazy page.  Its AUX is shared with the parent. */
+		return vm_alloc_page_with_initializer (src_page->uninit.type,
+				src_page->va, src_page->writable, src_page->uninit.init,
+				src_page->uninit.aux);
+	} else {
+		if (!vm_alloc_page (page_get_type (src_page), src_page->va,
+					src_page->writable))
+			return false;
+		page = spt_find_page (dst, src_page->va);
+	}
+	if (page == NULL)
+		return false;
+	if (VM_TYPE (src_page->operations->type) == VM_ANON)
+		return share_page (page, src_page);
+
+	/* A page of the parent that was evicted must be brought back to
+	 * be copied, and must stay while the child's frame is found. */
+	frame_table_lock ();
+	while ((frame = vm_page_frame (src_page)) == NULL) {
+		frame_table_unlock ();
+		if (!vm_do_claim_page (src_page))
+			return false;
+		frame_table_lock ();
+	}
+	frame->pin_cnt++;
+	frame_table_unlock ();
+	ok = vm_do_claim_page (page);
+	/* Unless both map the same page cache frame. */
+	if (ok && page->frame != frame)
+		memcpy (page->frame->kva, frame->kva, PGSIZE);
+	frame_unpin (frame);
+	return ok;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct hash_iterator i;
+
+	if (!spt_for_each_area (src, copy_area, dst))
+		return false;
+	dst->heap_start = src->heap_start;
+	dst->brk = src->brk;
+	dst->stack_limit = src->stack_limit;
+
+	hash_first (&i, &src->pages);
+	while (hash_next (&i)) {
+		struct page *src_page = hash_entry (hash_cur (&i), struct page,
+				spt_elem);
+		if (!copy_page (dst, src_page))
+			return false;
+	}
+	return true;
+}
+
+/* Destroys a page that is not part of any area. */
+static void
+page_kill (struct hash_elem *e, void *aux UNUSED) {
+	vm_dealloc_page (hash_entry (e, struct page, spt_elem));
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	if (!spt->active)
+		return;
+
+	/* The modified pages of file mappings are written back as their
+	 * areas are destroyed. */
+	while (spt->areas != NULL)
+		vm_area_destroy (spt, spt->areas);
+	hash_destroy (&spt->pages, page_kill);
+	spt->active = false;
 }
@@ -0,0 +1,234 @@
+/* zswap.c: Compressed cache of swapped-out anonymous pages.
+ *
+ * Evicted anonymous pages are LZ4-compressed and kept in a pool of
+ * kernel pages instead of being written to the swap disk.  Reading
+ * one back costs a decompression rather than a disk read.  The pool
+ * may use up to zswap_max_percent of RAM, but never more than half of
+ * the kernel pool, whose pages it takes, nor the last
+ * ZSWAP_KERNEL_RESERVE free kernel pages.  When it is full, anon.c
+ * writes its oldest entries on to the swap disk.
+ *
+ * The pool is a size-class allocator.  Class I holds objects of
+ * (I + 1) * ZCLASS_GRAIN bytes.  Each pool page holds objects of
+ * a single class, and a bitmap tracks its free objects.  A page
+ * that compresses to more than ZSWAP_MAX_LEN bytes is not worth
+ * keeping, so it is refused.
+ *
+ * Nothing here locks.  Callers serialize every call; anon.c does so
+ * with its swap lock. */
+
+#include "vm/zswap.h"
+#include <debug.h>
+#include <list.h>
+#include <lz4.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define ZCLASS_GRAIN 64                       /* Size class step. */
+#define ZSWAP_MAX_LEN (PGSIZE / 4 * 3)        /* Largest object kept. */
+#define ZCLASS_CNT (ZSWAP_MAX_LEN / ZCLASS_GRAIN)
+
+/* Free kernel pages the pool leaves to the rest of the kernel. */
+#define ZSWAP_KERNEL_RESERVE 64
+
+/* A pool page, carved into objects of one size class. */
+struct zpage {
+	struct list_elem elem;      /* Element in its class's partial list. */
+	uint8_t *kva;               /* The page. */
+	int class;                  /* Size class. */
+	uint64_t free_map;          /* Bit I set if object I is free. */
+	unsigned used_cnt;          /* Objects in use. */
+};
+
+/* A compressed page. */
+struct zswap_entry {
+	struct list_elem lru_elem;  /* Element in LRU, oldest first. */
+	struct page *page;          /* The page it holds, once attached. */
+	struct zpage *zpage;        /* Pool page holding the object... */
+	unsigned obj;               /* ...and its index there. */
+	size_t len;                 /* Compressed length. */
+};
+
+int zswap_max_percent = 20;
+
+static struct list partial[ZCLASS_CNT]; /* Pool pages with free objects. */
+static struct list lru;                 /* All entries, oldest first. */
+static size_t pool_pages;               /* Pages in the pool. */
+static size_t pool_limit;               /* Most pages in the pool. */
+static size_t stored_cnt;               /* Entries in the pool. */
+
+static uint8_t cbuf[ZSWAP_MAX_LEN];     /* Compression output. */
+static uint8_t work[LZ4_WORK_SIZE];     /* Compression scratch. */
+
+/* Statistics. */
+static long long store_cnt;             /* Pages stored. */
+static long long reject_cnt;            /* Pages refused. */
+static long long load_cnt;              /* Pages loaded. */
+
+void
+zswap_init (void) {
+	int i;
+
+	for (i = 0; i < ZCLASS_CNT; i++)
+		list_init (&partial[i]);
+	list_init (&lru);
+	if (zswap_max_percent < 0)
+		zswap_max_percent = 0;
+	else if (zswap_max_percent > 100)
+		zswap_max_percent = 100;
+	pool_limit = ram_pages * zswap_max_percent / 100;
+	if (pool_limit > palloc_kernel_size () / 2)
+		pool_limit = palloc_kernel_size () / 2;
+}
+
+static size_t
+class_size (int class) {
+	return (size_t) (class + 1) * ZCLASS_GRAIN;
+}
+
+/* Allocates an object of CLASS, storing its page and index into
+ * *ZP and *OBJ.  Returns false if out of memory. */
+static bool
+obj_alloc (int class, struct zpage **zp, unsigned *obj) {
+	struct zpage *z;
+
+	if (list_empty (&partial[class])) {
+		size_t obj_cnt = PGSIZE / class_size (class);
+
+		z = malloc (sizeof *z);
+		if (z == NULL)
+			return false;
+		z->kva = palloc_get_page (0);
+		if (z->kva == NULL) {
+			free (z);
+			return false;
+		}
+		z->class = class;
+		z->free_map = obj_cnt < 64 ? (1ULL << obj_cnt) - 1 : UINT64_MAX;
+		z->used_cnt = 0;
+		list_push_front (&partial[class], &z->elem);
+		pool_pages++;
+	}
+
+	z = list_entry (list_front (&partial[class]), struct zpage, elem);
+	*zp = z;
+	*obj = __builtin_ctzll (z->free_map);
+	z->free_map &= ~(1ULL << *obj);
+	z->used_cnt++;
+	if (z->free_map == 0)
+		list_remove (&z->elem);
+	return true;
+}
+
+/* Frees object OBJ of ZP, and ZP itself once it is empty. */
+static void
+obj_free (struct zpage *z, unsigned obj) {
+	ASSERT ((z->free_map & (1ULL << obj)) == 0);
+
+	if (z->free_map == 0)
+		list_push_front (&partial[z->class], &z->elem);
+	z->free_map |= 1ULL << obj;
+	if (--z->used_cnt == 0) {
+		list_remove (&z->elem);
+		palloc_free_page (z->kva);
+		free (z);
+		pool_pages--;
+	}
+}
+
+/* Compresses the page at KVA into the pool.  Returns the new entry,
+ * or a null pointer if the page does not compress well or memory is
+ * short.  The entry is not written back to disk until it is given to
+ * its page with zswap_attach(). */
+struct zswap_entry *
+zswap_store (const void *kva) {
+	struct zswap_entry *e;
+	size_t len = lz4_compress (kva, PGSIZE, cbuf, sizeof cbuf, work);
+	int class;
+
+	if (len == 0 || (e = malloc (sizeof *e)) == NULL) {
+		reject_cnt++;
+		return NULL;
+	}
+	class = (len - 1) / ZCLASS_GRAIN;
+	if (!obj_alloc (class, &e->zpage, &e->obj)) {
+		free (e);
+		reject_cnt++;
+		return NULL;
+	}
+	memcpy (e->zpage->kva + e->obj * class_size (class), cbuf, len);
+	e->page = NULL;
+	e->len = len;
+	stored_cnt++;
+	store_cnt++;
+	return e;
+}
+
+/* Makes ENTRY hold PAGE, and the newest entry of the pool. */
+void
+zswap_attach (struct zswap_entry *e, struct page *page) {
+	ASSERT (e->page == NULL);
+
+	e->page = page;
+	list_push_back (&lru, &e->lru_elem);
+}
+
+/* Decompresses ENTRY into KVA.  ENTRY stays in the pool. */
+void
+zswap_load (struct zswap_entry *e, void *kva) {
+	const uint8_t *obj = e->zpage->kva
+		+ e->obj * class_size (e->zpage->class);
+
+	if (lz4_decompress (obj, e->len, kva, PGSIZE) != PGSIZE)
+		PANIC ("zswap: corrupt entry for page %p", zswap_page (e));
+	load_cnt++;
+}
+
+/* Removes ENTRY from the pool. */
+void
+zswap_free (struct zswap_entry *e) {
+	if (e->page != NULL)
+		list_remove (&e->lru_elem);
+	obj_free (e->zpage, e->obj);
+	free (e);
+	stored_cnt--;
+}
+
+/* Returns whether the pool has reached its share of RAM, or the
+ * kernel is short of pages. */
+bool
+zswap_full (void) {
+	return pool_pages >= pool_limit
+		|| palloc_kernel_free () < ZSWAP_KERNEL_RESERVE;
+}
+
+/* Stores up to CNT of the oldest entries into ENTRIES, oldest first,
+ * and returns how many. */
+size_t
+zswap_oldest (struct zswap_entry *entries[], size_t cnt) {
+	struct list_elem *e;
+	size_t n = 0;
+
+	for (e = list_begin (&lru); e != list_end (&lru) && n < cnt;
+			e = list_next (e))
+		entries[n++] = list_entry (e, struct zswap_entry, lru_elem);
+	return n;
+}
+
+/* Returns the page that ENTRY holds. */
+struct page *
+zswap_page (struct zswap_entry *e) {
+	return e->page;
+}
+
+void
+zswap_print_stats (void) {
+	printf ("Zswap: %zu pages in %zu pool pages, %lld stores, %lld refused, "
+			"%lld loads\n", stored_cnt, pool_pages, store_cnt, reject_cnt,
+			load_cnt);
+}